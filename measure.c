@@ -0,0 +1,1369 @@
+/*
+ * This file is part of the sps-alsa-explore distribution
+ * (https://github.com/mikebrady/sps-alsa-explore). Copyright (c) 2021-2024 Mike Brady.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Commercial licensing is also available.
+ */
+
+
+#include "measure.h"
+#include "sps-alsa-explore.h"
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+measurement_options measurements;
+
+// the time silence is played for in each measurement
+#define MEASURE_PLAY_TIME 2.0
+#define MEASURE_MAX_SAMPLES 8192
+
+// A device open for playback of silence, one period at a time.
+typedef struct {
+  snd_pcm_t *handle;
+  unsigned int rate;
+  snd_pcm_uframes_t period_size;
+  snd_pcm_uframes_t buffer_size;
+  uint64_t frames_written;
+  char *silence; // a period of it
+  struct pollfd *fds;
+  int fd_count;
+  int alsa_error; // the ALSA error code if measure_stream_open() failed
+} measure_stream;
+
+// called after each period is written
+typedef void (*measure_stream_observer)(measure_stream *s, void *context);
+
+static double measure_time_now(clockid_t clock) {
+  struct timespec tn;
+  clock_gettime(clock, &tn);
+  return tn.tv_sec + tn.tv_nsec * 0.000000001;
+}
+
+static double measure_timespec_seconds(const struct timespec *t) {
+  return t->tv_sec + t->tv_nsec * 0.000000001;
+}
+
+static void measure_stream_close(measure_stream *s) {
+  if (s->handle != NULL) {
+    snd_pcm_drop(s->handle);
+    snd_pcm_close(s->handle);
+  }
+  free(s->silence);
+  free(s->fds);
+  memset(s, 0, sizeof(measure_stream));
+}
+
+// Get the period and buffer sizes of the open device and set up the silence and the poll
+// descriptors to suit. Returns 0 or -SPS_EXPLORE_STATUS_ERROR.
+static int measure_stream_set_up(measure_stream *s, snd_pcm_format_t format) {
+  snd_pcm_hw_params_t *params;
+  snd_pcm_hw_params_alloca(&params);
+  snd_pcm_hw_params_current(s->handle, params);
+  snd_pcm_hw_params_get_period_size(params, &s->period_size, NULL);
+  snd_pcm_hw_params_get_buffer_size(params, &s->buffer_size);
+  s->fd_count = snd_pcm_poll_descriptors_count(s->handle);
+  free(s->silence);
+  free(s->fds);
+  s->silence = NULL;
+  s->fds = NULL;
+  if ((s->period_size != 0) && (s->fd_count > 0)) {
+    s->silence = malloc(snd_pcm_frames_to_bytes(s->handle, s->period_size));
+    s->fds = malloc(s->fd_count * sizeof(struct pollfd));
+  }
+  if ((s->silence == NULL) || (s->fds == NULL))
+    return -SPS_EXPLORE_STATUS_ERROR;
+  snd_pcm_format_set_silence(format, s->silence, s->period_size * 2);
+  snd_pcm_poll_descriptors(s->handle, s->fds, s->fd_count);
+  return 0;
+}
+
+// returns 0 or the negative of an sps_explore_status, with the ALSA error code in s->alsa_error
+static int measure_stream_open(measure_stream *s, const char *device_name, snd_pcm_format_t format,
+                               unsigned int rate, const alsa_device_settings *settings) {
+  memset(s, 0, sizeof(measure_stream));
+  alsa_device_settings open_settings;
+  if (settings != NULL)
+    open_settings = *settings;
+  else
+    memset(&open_settings, 0, sizeof(open_settings));
+  int alsa_error = 0;
+  open_settings.alsa_error = &alsa_error;
+  int ret = open_alsa_device_with_settings(device_name, format, rate, &open_settings, &s->handle);
+  if (ret != 0) {
+    s->handle = NULL;
+    s->alsa_error = alsa_error;
+    return ret;
+  }
+  s->rate = rate;
+  ret = measure_stream_set_up(s, format);
+  if (ret != 0) {
+    debug(1, "can not set up playback of silence to \"%s\".", device_name);
+    measure_stream_close(s);
+    s->alsa_error = -ENOMEM;
+  }
+  return ret;
+}
+
+// Stop the device and set it up again at another rate, without closing it.
+// Returns 0 or the negative of an sps_explore_status.
+static int measure_stream_reconfigure(measure_stream *s, const char *device_name,
+                                      snd_pcm_format_t format, unsigned int rate,
+                                      const alsa_device_settings *settings) {
+  snd_pcm_drop(s->handle);
+  int ret = snd_pcm_hw_free(s->handle);
+  if (ret == 0)
+    ret = configure_alsa_device_with_settings(s->handle, device_name, format, rate, settings);
+  else
+    ret = -SPS_EXPLORE_STATUS_ERROR;
+  if (ret == 0) {
+    s->rate = rate;
+    ret = measure_stream_set_up(s, format);
+  }
+  return ret;
+}
+
+// Write a period of silence. Returns the number of frames written or a negative ALSA error code.
+static snd_pcm_sframes_t measure_stream_write(measure_stream *s) {
+  snd_pcm_sframes_t ret = snd_pcm_writei(s->handle, s->silence, s->period_size);
+  if (ret > 0)
+    s->frames_written += ret;
+  return ret;
+}
+
+// Fill the buffer of the prepared device with silence and start playing.
+// Returns 0 or a negative ALSA error code.
+static int measure_stream_fill_and_start(measure_stream *s) {
+  int ret = 0;
+  s->frames_written = 0;
+  while ((ret == 0) && (s->frames_written + s->period_size <= s->buffer_size)) {
+    snd_pcm_sframes_t written = measure_stream_write(s);
+    if (written < 0)
+      ret = written;
+  }
+  if ((ret == 0) && (snd_pcm_state(s->handle) == SND_PCM_STATE_PREPARED))
+    ret = snd_pcm_start(s->handle);
+  return ret;
+}
+
+// Fill the buffer with silence and start playing. Returns 0 or a negative ALSA error code.
+static int measure_stream_start(measure_stream *s) {
+  int ret = snd_pcm_prepare(s->handle);
+  if (ret == 0)
+    ret = measure_stream_fill_and_start(s);
+  return ret;
+}
+
+// Wait until a period can be written. Returns 1 if it can, 0 if the timeout expired, or a
+// negative error code, -EPIPE if the device has underrun.
+static int measure_stream_wait(measure_stream *s, int timeout_ms) {
+  int ret = poll(s->fds, s->fd_count, timeout_ms);
+  if (ret <= 0)
+    return ((ret == 0) || (errno == EINTR)) ? 0 : -errno;
+  unsigned short revents;
+  ret = snd_pcm_poll_descriptors_revents(s->handle, s->fds, s->fd_count, &revents);
+  if (ret < 0)
+    return ret;
+  if (revents & POLLERR)
+    return snd_pcm_state(s->handle) == SND_PCM_STATE_XRUN ? -EPIPE : -EIO;
+  return (revents & POLLOUT) != 0;
+}
+
+// Start playing silence and keep playing it for the time given, calling the observer, if
+// there is one, after every period written.
+// Returns the number of underruns recovered from or a negative ALSA error code.
+static int measure_stream_play(measure_stream *s, double seconds, measure_stream_observer observer,
+                               void *context) {
+  int underruns = 0;
+  int ret = measure_stream_start(s);
+  double finish_time = measure_time_now(CLOCK_MONOTONIC) + seconds;
+  while ((ret >= 0) && (measure_time_now(CLOCK_MONOTONIC) < finish_time)) {
+    ret = measure_stream_wait(s, 1000);
+    if (ret > 0) {
+      snd_pcm_sframes_t written = measure_stream_write(s);
+      ret = written < 0 ? (int)written : 0;
+      if ((ret == 0) && (observer != NULL))
+        observer(s, context);
+    }
+    if (ret == -EPIPE) {
+      underruns++;
+      ret = measure_stream_start(s);
+    }
+  }
+  return ret < 0 ? ret : underruns;
+}
+
+typedef struct {
+  double mean;
+  double standard_deviation;
+  double maximum_deviation; // from the mean
+} measure_statistics;
+
+static void measure_statistics_calculate(const double *values, int count, measure_statistics *stats) {
+  memset(stats, 0, sizeof(measure_statistics));
+  if (count == 0)
+    return;
+  int i;
+  for (i = 0; i < count; i++)
+    stats->mean += values[i];
+  stats->mean = stats->mean / count;
+  for (i = 0; i < count; i++) {
+    double deviation = fabs(values[i] - stats->mean);
+    stats->standard_deviation += deviation * deviation;
+    if (deviation > stats->maximum_deviation)
+      stats->maximum_deviation = deviation;
+  }
+  stats->standard_deviation = sqrt(stats->standard_deviation / count);
+}
+
+static int measure_compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// The value below which the given percentage of the values lie, by the nearest-rank method.
+// The values are sorted in place.
+static double measure_percentile(double *values, int count, double percentage) {
+  if (count == 0)
+    return 0.0;
+  qsort(values, count, sizeof(double), measure_compare_doubles);
+  int rank = (int)ceil(percentage / 100.0 * count);
+  if (rank < 1)
+    rank = 1;
+  return values[rank - 1];
+}
+
+// least-squares fit of y = intercept + slope * x
+static void measure_fit_line(const double *x, const double *y, int count, double *intercept,
+                             double *slope) {
+  double mean_x = 0.0, mean_y = 0.0, sxx = 0.0, sxy = 0.0;
+  int i;
+  for (i = 0; i < count; i++) {
+    mean_x += x[i];
+    mean_y += y[i];
+  }
+  mean_x = mean_x / count;
+  mean_y = mean_y / count;
+  for (i = 0; i < count; i++) {
+    sxx += (x[i] - mean_x) * (x[i] - mean_x);
+    sxy += (x[i] - mean_x) * (y[i] - mean_y);
+  }
+  *slope = sxx != 0.0 ? sxy / sxx : 0.0;
+  *intercept = mean_y - *slope * mean_x;
+}
+
+static int measure_set_tstamp_type(snd_pcm_t *handle, snd_pcm_tstamp_type_t type) {
+  snd_pcm_sw_params_t *swparams;
+  snd_pcm_sw_params_alloca(&swparams);
+  int ret = snd_pcm_sw_params_current(handle, swparams);
+  if (ret == 0)
+    ret = snd_pcm_sw_params_set_tstamp_type(handle, swparams, type);
+  if (ret == 0)
+    ret = snd_pcm_sw_params(handle, swparams);
+  return ret;
+}
+
+typedef struct {
+  int value;
+  const char *name;
+} measure_named_value;
+
+typedef struct {
+  clockid_t clock; // the system clock the device's timestamps come from
+  int count;
+  double local_time[MEASURE_MAX_SAMPLES];
+  double timestamp[MEASURE_MAX_SAMPLES];
+  double position[MEASURE_MAX_SAMPLES]; // seconds of audio played at the time of the timestamp
+  long nanoseconds[MEASURE_MAX_SAMPLES];
+} timestamp_samples;
+
+static void timestamp_observer(measure_stream *s, void *context) {
+  timestamp_samples *t = context;
+  snd_pcm_status_t *status;
+  snd_pcm_status_alloca(&status);
+  if ((t->count < MEASURE_MAX_SAMPLES) && (snd_pcm_status(s->handle, status) == 0) &&
+      (snd_pcm_status_get_state(status) == SND_PCM_STATE_RUNNING)) {
+    double local_time = measure_time_now(t->clock);
+    snd_htimestamp_t timestamp;
+    snd_pcm_status_get_htstamp(status, &timestamp);
+    if ((timestamp.tv_sec != 0) || (timestamp.tv_nsec != 0)) {
+      t->local_time[t->count] = local_time;
+      t->timestamp[t->count] = measure_timespec_seconds(&timestamp);
+      t->position[t->count] =
+          (double)(s->frames_written - snd_pcm_status_get_delay(status)) / s->rate;
+      t->nanoseconds[t->count] = timestamp.tv_nsec;
+      t->count++;
+    }
+  }
+}
+
+static void measure_timestamps(const char *device_name, snd_pcm_format_t format,
+                               unsigned int rate) {
+  static const measure_named_value audio_tstamp_types[] = {
+      {SND_PCM_AUDIO_TSTAMP_TYPE_DEFAULT, "default"},
+      {SND_PCM_AUDIO_TSTAMP_TYPE_LINK, "link"},
+      {SND_PCM_AUDIO_TSTAMP_TYPE_LINK_ABSOLUTE, "link-absolute"},
+      {SND_PCM_AUDIO_TSTAMP_TYPE_LINK_ESTIMATED, "link-estimated"},
+  };
+  static const measure_named_value tstamp_types[] = {
+      {SND_PCM_TSTAMP_TYPE_MONOTONIC_RAW, "monotonic-raw"},
+      {SND_PCM_TSTAMP_TYPE_MONOTONIC, "monotonic"},
+      {SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY, "gettimeofday"},
+  };
+  measure_stream s;
+  int ret = measure_stream_open(&s, device_name, format, rate, NULL);
+  if (ret != 0) {
+    inform("    Timestamps:        can not be measured -- the device could not be opened.");
+    return;
+  }
+  char types[128] = "";
+  snd_pcm_hw_params_t *params;
+  snd_pcm_hw_params_alloca(&params);
+  size_t i;
+  if (snd_pcm_hw_params_current(s.handle, params) == 0) {
+    for (i = 0; i < sizeof(audio_tstamp_types) / sizeof(audio_tstamp_types[0]); i++)
+      if (snd_pcm_hw_params_supports_audio_ts_type(params, audio_tstamp_types[i].value))
+        snprintf(types + strlen(types), sizeof(types) - strlen(types), "%s%s",
+                 types[0] == '\0' ? "" : ", ", audio_tstamp_types[i].name);
+  }
+  inform("    Audio Timestamps:  %s.", types[0] == '\0' ? "none" : types);
+  types[0] = '\0';
+  for (i = 0; i < sizeof(tstamp_types) / sizeof(tstamp_types[0]); i++)
+    if (measure_set_tstamp_type(s.handle, tstamp_types[i].value) == 0)
+      snprintf(types + strlen(types), sizeof(types) - strlen(types), "%s%s",
+               types[0] == '\0' ? "" : ", ", tstamp_types[i].name);
+  inform("    System Timestamps: %s.", types[0] == '\0' ? "none" : types);
+
+  // compare the timestamps with the clock they come from
+  timestamp_samples *t = calloc(1, sizeof(timestamp_samples));
+  if (t == NULL)
+    die("can not allocate memory to measure timestamps.");
+  t->clock = CLOCK_MONOTONIC;
+  if (measure_set_tstamp_type(s.handle, SND_PCM_TSTAMP_TYPE_MONOTONIC) != 0) {
+    measure_set_tstamp_type(s.handle, SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY);
+    t->clock = CLOCK_REALTIME;
+  }
+  ret = measure_stream_play(&s, MEASURE_PLAY_TIME, timestamp_observer, t);
+  if (ret < 0) {
+    inform("    Timestamp Jitter:  can not be measured -- playing failed: %s.", snd_strerror(ret));
+  } else if (t->count < 3) {
+    inform("    Timestamp Jitter:  can not be measured -- too few timestamps were reported.");
+  } else {
+    // the resolution is taken to be the largest power of ten dividing every timestamp
+    long resolution = 1000000000;
+    int j;
+    for (j = 0; j < t->count; j++)
+      while ((resolution > 1) && (t->nanoseconds[j] % resolution != 0))
+        resolution = resolution / 10;
+    inform("    Resolution:        %ld ns.", resolution);
+    double *deviations = malloc(t->count * sizeof(double));
+    if (deviations == NULL)
+      die("can not allocate memory to measure timestamps.");
+    measure_statistics stats;
+    // how long after a timestamp it was read
+    for (j = 0; j < t->count; j++)
+      deviations[j] = t->local_time[j] - t->timestamp[j];
+    measure_statistics_calculate(deviations, t->count, &stats);
+    inform("    Jitter Against the System Clock:   standard deviation %.1f us, maximum %.1f us.",
+           stats.standard_deviation * 1000000, stats.maximum_deviation * 1000000);
+    // how closely the timestamps follow the audio played, allowing for a constant rate difference
+    double intercept, slope;
+    measure_fit_line(t->timestamp, t->position, t->count, &intercept, &slope);
+    for (j = 0; j < t->count; j++)
+      deviations[j] = t->position[j] - (intercept + slope * t->timestamp[j]);
+    measure_statistics_calculate(deviations, t->count, &stats);
+    inform("    Jitter Against the Audio Position: standard deviation %.1f us, maximum %.1f us.",
+           stats.standard_deviation * 1000000, stats.maximum_deviation * 1000000);
+    inform("    Rate Relative to the System Clock: %+.1f ppm, from %d timestamps%s.",
+           (slope - 1.0) * 1000000, t->count, ret > 0 ? " (with underruns)" : "");
+    free(deviations);
+  }
+  free(t);
+  measure_stream_close(&s);
+}
+
+typedef enum {
+  STARTUP_OPEN = 0,
+  STARTUP_CONFIGURE,
+  STARTUP_PREPARE,
+  STARTUP_START,
+  STARTUP_FIRST_FRAME, // from starting to the hardware pointer's first advance
+  STARTUP_TOTAL,
+  STARTUP_STAGE_COUNT,
+} startup_stage;
+
+static const char *startup_stage_names[STARTUP_STAGE_COUNT] = {
+    "open", "set up", "prepare", "start", "first frame", "total"};
+
+// Time the stages from preparing the stream to the first frame being played.
+// The stream is left playing, so it must be stopped before being prepared again.
+static int measure_startup_from_prepare(measure_stream *s, double *stages) {
+  double time_now = measure_time_now(CLOCK_MONOTONIC);
+  int ret = snd_pcm_prepare(s->handle);
+  stages[STARTUP_PREPARE] = measure_time_now(CLOCK_MONOTONIC) - time_now;
+  time_now = measure_time_now(CLOCK_MONOTONIC);
+  s->frames_written = 0;
+  if (ret == 0) {
+    snd_pcm_sframes_t written = measure_stream_write(s);
+    ret = written < 0 ? (int)written : snd_pcm_start(s->handle);
+  }
+  stages[STARTUP_START] = measure_time_now(CLOCK_MONOTONIC) - time_now;
+  time_now = measure_time_now(CLOCK_MONOTONIC);
+  if (ret == 0) {
+    snd_pcm_sframes_t initial_avail = snd_pcm_avail(s->handle);
+    snd_pcm_sframes_t avail = initial_avail;
+    while ((avail == initial_avail) && (measure_time_now(CLOCK_MONOTONIC) - time_now < 2.0)) {
+      struct timespec pause = {0, 100000};
+      nanosleep(&pause, NULL);
+      avail = snd_pcm_avail(s->handle);
+    }
+    if (avail < 0)
+      ret = avail;
+    else if (avail == initial_avail)
+      ret = -ETIMEDOUT;
+  }
+  stages[STARTUP_FIRST_FRAME] = measure_time_now(CLOCK_MONOTONIC) - time_now;
+  return ret;
+}
+
+static void measure_startup_report(const char *title, double **stages, int runs) {
+  double *totals = stages[STARTUP_TOTAL];
+  inform("      %-20s median %.1f ms, 90th percentile %.1f ms, maximum %.1f ms.", title,
+         measure_percentile(totals, runs, 50) * 1000, measure_percentile(totals, runs, 90) * 1000,
+         measure_percentile(totals, runs, 100) * 1000);
+  char medians[256] = "";
+  int stage;
+  for (stage = 0; stage < STARTUP_TOTAL; stage++) {
+    if (stages[stage] != NULL)
+      snprintf(medians + strlen(medians), sizeof(medians) - strlen(medians), "%s%s %.1f ms",
+               medians[0] == '\0' ? "" : ", ", startup_stage_names[stage],
+               measure_percentile(stages[stage], runs, 50) * 1000);
+  }
+  inform("        Median Stages:     %s.", medians);
+}
+
+// Measure the time from opening the device, or from preparing it if it's already open, to the
+// first frame being played.
+static void measure_startup(const char *device_name, snd_pcm_format_t format, unsigned int rate,
+                            measurement_summary *summary) {
+  int runs = measurements.startup_runs;
+  double *values = calloc(STARTUP_STAGE_COUNT * runs, sizeof(double));
+  if (values == NULL)
+    die("can not allocate memory to measure startup times.");
+  double *stages[STARTUP_STAGE_COUNT];
+  alsa_device_timing timing;
+  alsa_device_settings settings;
+  memset(&settings, 0, sizeof(settings));
+  settings.explicit_start = 1;
+  settings.timing = &timing;
+  measure_stream s;
+  double run_stages[STARTUP_STAGE_COUNT];
+  int ret = 0;
+  int idle, run, stage;
+  inform("    Time to First Frame, over %d runs:", runs);
+
+  // cold: opened from closed, straight after being closed and again after being idle
+  for (idle = 0; (idle <= (measurements.startup_idle_time > 0 ? 1 : 0)) && (ret == 0); idle++) {
+    for (stage = 0; stage < STARTUP_STAGE_COUNT; stage++)
+      stages[stage] = values + stage * runs;
+    for (run = 0; (run < runs) && (ret == 0); run++) {
+      if (idle != 0) {
+        struct timespec pause = {measurements.startup_idle_time, 0};
+        nanosleep(&pause, NULL);
+      }
+      ret = measure_stream_open(&s, device_name, format, rate, &settings);
+      if (ret == 0) {
+        run_stages[STARTUP_OPEN] = timing.open;
+        run_stages[STARTUP_CONFIGURE] = timing.configure;
+        ret = measure_startup_from_prepare(&s, run_stages);
+        measure_stream_close(&s);
+      }
+      stages[STARTUP_TOTAL][run] = 0.0;
+      for (stage = 0; stage < STARTUP_TOTAL; stage++) {
+        stages[stage][run] = run_stages[stage];
+        stages[STARTUP_TOTAL][run] += run_stages[stage];
+      }
+    }
+    if (ret == 0) {
+      measure_startup_report(idle == 0 ? "Cold:" : "Cold, After Idling:", stages, runs);
+      if (idle == 0)
+        summary->startup_time = measure_percentile(stages[STARTUP_TOTAL], runs, 50);
+    }
+  }
+
+  // warm: stopped with snd_pcm_drop() and prepared again on the open handle
+  if (ret == 0)
+    ret = measure_stream_open(&s, device_name, format, rate, &settings);
+  if (ret == 0) {
+    stages[STARTUP_OPEN] = NULL;
+    stages[STARTUP_CONFIGURE] = NULL;
+    for (run = 0; (run < runs) && (ret == 0); run++) {
+      snd_pcm_drop(s.handle);
+      ret = measure_startup_from_prepare(&s, run_stages);
+      stages[STARTUP_TOTAL][run] = 0.0;
+      for (stage = STARTUP_PREPARE; stage < STARTUP_TOTAL; stage++) {
+        stages[stage][run] = run_stages[stage];
+        stages[STARTUP_TOTAL][run] += run_stages[stage];
+      }
+    }
+    measure_stream_close(&s);
+    if (ret == 0)
+      measure_startup_report("Warm:", stages, runs);
+  }
+  if (ret == -ETIMEDOUT)
+    inform("    Startup can not be measured -- the device did not start playing.");
+  else if (ret != 0)
+    inform("    Startup can not be measured -- error: %s.", snd_strerror(ret));
+  free(values);
+}
+
+// switching rates takes longer than this, the gap is clearly audible
+#define MEASURE_SLOW_RATE_SWITCH 0.1
+
+// Switch a playing stream to another rate, either by reconfiguring it or by closing and reopening
+// it, timing it until the first frame at the new rate is played.
+static int measure_rate_switch(measure_stream *s, const char *device_name, snd_pcm_format_t format,
+                               unsigned int rate, int reopen, double *seconds) {
+  alsa_device_settings settings;
+  memset(&settings, 0, sizeof(settings));
+  settings.explicit_start = 1;
+  double stages[STARTUP_STAGE_COUNT];
+  double start_time = measure_time_now(CLOCK_MONOTONIC);
+  int ret;
+  if (reopen != 0) {
+    measure_stream_close(s);
+    ret = measure_stream_open(s, device_name, format, rate, &settings);
+  } else {
+    ret = measure_stream_reconfigure(s, device_name, format, rate, &settings);
+  }
+  if (ret == 0)
+    ret = measure_startup_from_prepare(s, stages);
+  *seconds = measure_time_now(CLOCK_MONOTONIC) - start_time;
+  return ret;
+}
+
+// For each pair of rates, time switching back and forth between them while playing.
+static void measure_rate_switching(const char *device_name, snd_pcm_format_t format,
+                                   const unsigned int *rates, int rate_count) {
+  if (rate_count < 2) {
+    inform("    Rate Switching:    not measured -- only one rate is available in this format.");
+    return;
+  }
+  int runs = measurements.rate_switch_runs;
+  double *times = malloc(2 * runs * sizeof(double));
+  if (times == NULL)
+    die("can not allocate memory to measure rate switching.");
+  inform("    Rate Switching, time to the first frame at the new rate, median of %d switches:",
+         2 * runs);
+  double slowest_switch = 0.0;
+  int i, j, reopen, run;
+  for (i = 0; i < rate_count; i++) {
+    for (j = i + 1; j < rate_count; j++) {
+      double medians[2];
+      int ret = 0;
+      for (reopen = 0; (reopen <= 1) && (ret == 0); reopen++) {
+        measure_stream s;
+        alsa_device_settings settings;
+        memset(&settings, 0, sizeof(settings));
+        settings.explicit_start = 1;
+        ret = measure_stream_open(&s, device_name, format, rates[i], &settings);
+        if (ret == 0) {
+          double stages[STARTUP_STAGE_COUNT];
+          ret = measure_startup_from_prepare(&s, stages);
+        }
+        for (run = 0; (run < 2 * runs) && (ret == 0); run++)
+          ret = measure_rate_switch(&s, device_name, format, run % 2 == 0 ? rates[j] : rates[i],
+                                    reopen, &times[run]);
+        measure_stream_close(&s);
+        if (ret == 0)
+          medians[reopen] = measure_percentile(times, 2 * runs, 50);
+      }
+      if (ret != 0) {
+        inform("      %6u <-> %-6u can not be measured -- switching failed.", rates[i], rates[j]);
+      } else {
+        inform("      %6u <-> %-6u reconfiguring %.1f ms, reopening %.1f ms.", rates[i], rates[j],
+               medians[0] * 1000, medians[1] * 1000);
+        double fastest = medians[0] < medians[1] ? medians[0] : medians[1];
+        if (fastest > slowest_switch)
+          slowest_switch = fastest;
+      }
+    }
+  }
+  if (slowest_switch > MEASURE_SLOW_RATE_SWITCH)
+    inform("    Switching rates on this device can take %.0f ms -- consider resampling to a single "
+           "rate instead.",
+           slowest_switch * 1000);
+  free(times);
+}
+
+// the buffer is made this many periods long when profiling a period size
+#define MEASURE_PERIODS_PER_BUFFER 4
+
+typedef struct {
+  snd_pcm_uframes_t period_size; // as set by the device
+  snd_pcm_uframes_t buffer_size;
+  double wakeups_per_second;
+  double cpu_percent; // of one core, user and system
+  double context_switches_per_second;
+  double sleep_median; // seconds spent in poll() waiting for each period
+  double sleep_minimum;
+  int underruns;
+} period_cost;
+
+static double measure_timeval_seconds(const struct timeval *t) {
+  return t->tv_sec + t->tv_usec * 0.000001;
+}
+
+// Play silence with a poll()-driven writer for the time given, counting its wakeups and timing its
+// sleeps, and find the CPU time and the context switches it costs.
+static int measure_period_cost(measure_stream *s, double seconds, period_cost *cost) {
+  double *sleeps = malloc(MEASURE_MAX_SAMPLES * sizeof(double));
+  if (sleeps == NULL)
+    die("can not allocate memory to profile period sizes.");
+  int sleep_count = 0;
+  int wakeups = 0;
+  struct rusage usage_before, usage_after;
+  getrusage(RUSAGE_SELF, &usage_before);
+  int ret = measure_stream_start(s);
+  double start_time = measure_time_now(CLOCK_MONOTONIC);
+  double now = start_time;
+  while ((ret >= 0) && (now < start_time + seconds)) {
+    ret = measure_stream_wait(s, 1000);
+    double woken = measure_time_now(CLOCK_MONOTONIC);
+    wakeups++;
+    if (sleep_count < MEASURE_MAX_SAMPLES)
+      sleeps[sleep_count++] = woken - now;
+    if (ret > 0) {
+      // write all that there is room for, as a writer trying to keep the buffer full would
+      snd_pcm_sframes_t avail;
+      while (((avail = snd_pcm_avail_update(s->handle)) >= (snd_pcm_sframes_t)s->period_size) &&
+             (ret >= 0)) {
+        snd_pcm_sframes_t written = measure_stream_write(s);
+        ret = written < 0 ? (int)written : 0;
+      }
+      if (avail < 0)
+        ret = avail;
+    }
+    if (ret == -EPIPE) {
+      cost->underruns++;
+      ret = measure_stream_start(s);
+    }
+    now = measure_time_now(CLOCK_MONOTONIC);
+  }
+  getrusage(RUSAGE_SELF, &usage_after);
+  double elapsed = now - start_time;
+  if ((ret >= 0) && (elapsed > 0.0)) {
+    double cpu_time = measure_timeval_seconds(&usage_after.ru_utime) -
+                      measure_timeval_seconds(&usage_before.ru_utime) +
+                      measure_timeval_seconds(&usage_after.ru_stime) -
+                      measure_timeval_seconds(&usage_before.ru_stime);
+    cost->period_size = s->period_size;
+    cost->buffer_size = s->buffer_size;
+    cost->wakeups_per_second = wakeups / elapsed;
+    cost->cpu_percent = cpu_time / elapsed * 100.0;
+    cost->context_switches_per_second =
+        (usage_after.ru_nvcsw - usage_before.ru_nvcsw + usage_after.ru_nivcsw -
+         usage_before.ru_nivcsw) /
+        elapsed;
+    cost->sleep_median = measure_percentile(sleeps, sleep_count, 50);
+    cost->sleep_minimum = sleeps[0];
+  }
+  free(sleeps);
+  return ret < 0 ? ret : 0;
+}
+
+// For each period size requested, play silence and report what it costs, smallest first.
+static void measure_period_sizes(const char *device_name, snd_pcm_format_t format,
+                                 unsigned int rate) {
+  inform("    Period Size Cost, playing for %.0f s at each size with a %d-period buffer:",
+         MEASURE_PLAY_TIME, MEASURE_PERIODS_PER_BUFFER);
+  inform("      Period     Buffer     Latency   Wakeups/s   CPU     Switches/s   Sleep, median "
+         "(min)");
+  snd_pcm_uframes_t last_period_size = 0;
+  int i;
+  for (i = 0; i < measurements.period_size_count; i++) {
+    alsa_device_settings settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.period_size = measurements.period_sizes[i];
+    settings.buffer_size = measurements.period_sizes[i] * MEASURE_PERIODS_PER_BUFFER;
+    measure_stream s;
+    period_cost cost;
+    memset(&cost, 0, sizeof(cost));
+    int ret = measure_stream_open(&s, device_name, format, rate, &settings);
+    if (ret != 0) {
+      inform("      %-10lu can not be measured -- the device can not be set up.",
+             measurements.period_sizes[i]);
+      continue;
+    }
+    if (s.period_size == last_period_size) {
+      debug(1, "\"%s\" gave the same period size, %lu frames, when %lu frames were requested.",
+            device_name, s.period_size, measurements.period_sizes[i]);
+      measure_stream_close(&s);
+      continue;
+    }
+    last_period_size = s.period_size;
+    ret = measure_period_cost(&s, MEASURE_PLAY_TIME, &cost);
+    measure_stream_close(&s);
+    if (ret != 0) {
+      inform("      %-10lu can not be measured -- playing failed: %s.", last_period_size,
+             snd_strerror(ret));
+      continue;
+    }
+    inform("      %-10lu %-10lu %6.1f ms %8.1f   %5.2f%%  %8.1f    %6.2f ms (%.2f ms)%s",
+           cost.period_size, cost.buffer_size, cost.buffer_size * 1000.0 / rate,
+           cost.wakeups_per_second, cost.cpu_percent, cost.context_switches_per_second,
+           cost.sleep_median * 1000, cost.sleep_minimum * 1000,
+           cost.underruns != 0 ? ", underran" : "");
+  }
+}
+
+// the time silence is played for under load, at each priority
+#define MEASURE_STRESS_TIME 10.0
+
+typedef struct {
+  pthread_t thread;
+  size_t memory_size; // bytes to sweep, zero for a load on the CPU alone
+  volatile int *stop;
+} stress_load;
+
+// Keep a core busy, sweeping through memory if asked to, until told to stop.
+static void *stress_load_thread(void *arg) {
+  stress_load *load = arg;
+  unsigned char *memory = NULL;
+  if (load->memory_size != 0) {
+    memory = malloc(load->memory_size);
+    if (memory == NULL)
+      debug(1, "can not allocate %zu bytes for a memory load.", load->memory_size);
+  }
+  volatile uint64_t x = 1;
+  while (*load->stop == 0) {
+    if (memory != NULL) {
+      size_t i;
+      for (i = 0; (i < load->memory_size) && (*load->stop == 0); i += 64) // a cache line at a time
+        memory[i] = (unsigned char)(memory[i] + x++);
+    } else {
+      int i;
+      for (i = 0; i < 100000; i++)
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    }
+  }
+  free(memory);
+  return NULL;
+}
+
+typedef struct {
+  double last_write;
+  int count;
+  double gaps[MEASURE_MAX_SAMPLES];
+  double worst_gap;
+} stress_samples;
+
+static void stress_observer(__attribute__((unused)) measure_stream *s, void *context) {
+  stress_samples *t = context;
+  double now = measure_time_now(CLOCK_MONOTONIC);
+  if (t->last_write != 0.0) {
+    double gap = now - t->last_write;
+    if (t->count < MEASURE_MAX_SAMPLES)
+      t->gaps[t->count++] = gap;
+    if (gap > t->worst_gap)
+      t->worst_gap = gap;
+  }
+  t->last_write = now;
+}
+
+// Lock the memory of the process and give the calling thread real-time priority, or undo that.
+// Returns 0 or a negative error code.
+static int measure_set_realtime(int realtime) {
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  if (realtime == 0) {
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    munlockall();
+    return 0;
+  }
+  param.sched_priority =
+      (sched_get_priority_min(SCHED_FIFO) + sched_get_priority_max(SCHED_FIFO)) / 2;
+  int ret = 0;
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    ret = -errno;
+  else if ((ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0)
+    ret = -ret;
+  if (ret != 0)
+    munlockall();
+  return ret;
+}
+
+// Play silence for the time given, timing the gaps between writes.
+// Returns the number of underruns or a negative error code.
+static int measure_stress_run(const char *device_name, snd_pcm_format_t format, unsigned int rate,
+                              stress_samples *samples, double *buffer_time) {
+  measure_stream s;
+  int ret = measure_stream_open(&s, device_name, format, rate, NULL);
+  if (ret != 0)
+    return s.alsa_error;
+  *buffer_time = (double)s.buffer_size / rate;
+  memset(samples, 0, sizeof(stress_samples));
+  ret = measure_stream_play(&s, MEASURE_STRESS_TIME, stress_observer, samples);
+  measure_stream_close(&s);
+  return ret;
+}
+
+// Play to the device with other threads loading the rest of the cores, first at normal priority
+// and then with real-time priority, and compare the worst gap between writes with the buffer.
+static void measure_under_load(const char *device_name, snd_pcm_format_t format,
+                               unsigned int rate, measurement_summary *summary) {
+  int thread_count = measurements.stress_threads;
+  if (thread_count == 0) {
+    thread_count = sysconf(_SC_NPROCESSORS_ONLN) - 1; // leave a core for the writer
+    if (thread_count < 1)
+      thread_count = 1;
+  }
+  stress_load *loads = calloc(thread_count, sizeof(stress_load));
+  stress_samples *samples = malloc(sizeof(stress_samples));
+  if ((loads == NULL) || (samples == NULL))
+    die("can not allocate memory to measure playing under load.");
+  volatile int stop = 0;
+  int i, started = 0;
+  for (i = 0; i < thread_count; i++) {
+    loads[i].memory_size = (size_t)measurements.stress_megabytes * 1024 * 1024 / thread_count;
+    loads[i].stop = &stop;
+    if (pthread_create(&loads[i].thread, NULL, stress_load_thread, &loads[i]) != 0)
+      break;
+    started++;
+  }
+  if (measurements.stress_megabytes != 0)
+    inform("    Under Load, %d load thread%s sweeping %d MB of memory, playing for %.0f s at each "
+           "priority:",
+           started, started == 1 ? "" : "s", measurements.stress_megabytes, MEASURE_STRESS_TIME);
+  else
+    inform("    Under Load, %d load thread%s, playing for %.0f s at each priority:", started,
+           started == 1 ? "" : "s", MEASURE_STRESS_TIME);
+  int realtime, normal_xruns = 0;
+  for (realtime = 0; realtime <= 1; realtime++) {
+    const char *title = realtime != 0 ? "SCHED_FIFO, locked:" : "Normal priority:";
+    double buffer_time = 0.0;
+    int ret = realtime != 0 ? measure_set_realtime(1) : 0;
+    if (ret != 0) {
+      inform("      %-24snot measured -- can not lock memory and set real-time priority: %s.",
+             title, strerror(-ret));
+      continue;
+    }
+    ret = measure_stress_run(device_name, format, rate, samples, &buffer_time);
+    if (realtime != 0)
+      measure_set_realtime(0);
+    if (ret < 0) {
+      inform("      %-24snot measured -- playing failed: %s.", title, snd_strerror(ret));
+    } else {
+      double worst_gap = samples->worst_gap;
+      double typical_gap = measure_percentile(samples->gaps, samples->count, 99.9);
+      inform("      %-24sxruns: %d, worst write-loop latency: %.1f ms (99.9%%: %.1f ms), margin: "
+             "%.1f ms of a %.1f ms buffer.",
+             title, ret, worst_gap * 1000, typical_gap * 1000, (buffer_time - worst_gap) * 1000,
+             buffer_time * 1000);
+      if (realtime == 0)
+        normal_xruns = summary->underruns = ret;
+      else if ((normal_xruns != 0) && (ret == 0))
+        inform("    This device underruns under load at normal priority but not with real-time "
+               "priority, so give the player real-time priority.");
+    }
+  }
+  stop = 1;
+  for (i = 0; i < started; i++)
+    pthread_join(loads[i].thread, NULL);
+  free(samples);
+  free(loads);
+}
+
+// the interval between samples of the position
+#define MEASURE_POSITION_INTERVAL 0.00025
+// positions are compared with those expected from this long after starting
+#define MEASURE_POSITION_SETTLE_TIME 0.1
+// if the position is coarser or less accurate than this, the player must interpolate between
+// updates of the position to keep in sync
+#define MEASURE_INTERPOLATION_THRESHOLD 0.001
+
+typedef enum {
+  POSITION_SOURCE_DELAY = 0,
+  POSITION_SOURCE_STATUS,
+  POSITION_SOURCE_COUNT,
+} position_source;
+
+static const char *position_source_names[POSITION_SOURCE_COUNT] = {"snd_pcm_delay:",
+                                                                   "snd_pcm_status:"};
+
+typedef struct {
+  int count;
+  double time[MEASURE_MAX_SAMPLES]; // since starting
+  snd_pcm_sframes_t position[POSITION_SOURCE_COUNT][MEASURE_MAX_SAMPLES];
+} position_samples;
+
+// Sample the position often while playing, keeping the buffer full.
+static int measure_position_sample(measure_stream *s, position_samples *p) {
+  snd_pcm_status_t *status;
+  snd_pcm_status_alloca(&status);
+  struct timespec interval = {0, (long)(MEASURE_POSITION_INTERVAL * 1000000000)};
+  int ret = measure_stream_start(s);
+  double start_time = measure_time_now(CLOCK_MONOTONIC);
+  p->count = 0;
+  while ((ret == 0) && (p->count < MEASURE_MAX_SAMPLES) &&
+         (measure_time_now(CLOCK_MONOTONIC) - start_time < MEASURE_PLAY_TIME)) {
+    nanosleep(&interval, NULL);
+    snd_pcm_sframes_t delay;
+    double time = measure_time_now(CLOCK_MONOTONIC) - start_time;
+    if ((ret = snd_pcm_delay(s->handle, &delay)) < 0)
+      break;
+    p->position[POSITION_SOURCE_DELAY][p->count] = s->frames_written - delay;
+    if ((ret = snd_pcm_status(s->handle, status)) < 0)
+      break;
+    p->position[POSITION_SOURCE_STATUS][p->count] =
+        s->frames_written - snd_pcm_status_get_delay(status);
+    p->time[p->count++] = time;
+    snd_pcm_sframes_t avail;
+    while ((ret == 0) &&
+           ((avail = snd_pcm_avail_update(s->handle)) >= (snd_pcm_sframes_t)s->period_size)) {
+      snd_pcm_sframes_t written = measure_stream_write(s);
+      ret = written < 0 ? (int)written : 0;
+    }
+  }
+  return ret;
+}
+
+// Report how finely, how consistently and how accurately a source gives the position.
+// Returns nonzero if it is too coarse or too inaccurate to be used without interpolation.
+static int measure_position_report(const position_samples *p, position_source source,
+                                   unsigned int rate) {
+  const snd_pcm_sframes_t *position = p->position[source];
+  double *steps = malloc(p->count * sizeof(double));
+  double *times = malloc(p->count * sizeof(double));
+  double *positions = malloc(p->count * sizeof(double));
+  if ((steps == NULL) || (times == NULL) || (positions == NULL))
+    die("can not allocate memory to measure position reporting.");
+  int step_count = 0, settled_count = 0, backward_steps = 0, i;
+  for (i = 1; i < p->count; i++) {
+    if (position[i] > position[i - 1])
+      steps[step_count++] = position[i] - position[i - 1];
+    else if (position[i] < position[i - 1])
+      backward_steps++;
+  }
+  for (i = 0; i < p->count; i++)
+    if (p->time[i] >= MEASURE_POSITION_SETTLE_TIME) {
+      times[settled_count] = p->time[i];
+      positions[settled_count] = position[i];
+      settled_count++;
+    }
+  // the error against the position expected from the time elapsed at the nominal rate, and what's
+  // left of it -- the jitter -- once the offset and the drift of the device's clock are fitted out
+  double intercept = 0.0, slope = 0.0;
+  if (settled_count != 0)
+    measure_fit_line(times, positions, settled_count, &intercept, &slope);
+  double error_rms = 0.0, error_maximum = 0.0, jitter_rms = 0.0, jitter_maximum = 0.0;
+  for (i = 0; i < settled_count; i++) {
+    double error = positions[i] - times[i] * rate;
+    double jitter = positions[i] - (intercept + slope * times[i]);
+    error_rms += error * error;
+    jitter_rms += jitter * jitter;
+    if (fabs(error) > error_maximum)
+      error_maximum = fabs(error);
+    if (fabs(jitter) > jitter_maximum)
+      jitter_maximum = fabs(jitter);
+  }
+  if (settled_count != 0) {
+    error_rms = sqrt(error_rms / settled_count);
+    jitter_rms = sqrt(jitter_rms / settled_count);
+  }
+  double median_step = measure_percentile(steps, step_count, 50);
+  double smallest_step = step_count != 0 ? steps[0] : 0.0;
+  inform("      %-17supdated every %.0f frames (median; smallest %.0f), %d backward step%s, "
+         "error %.1f frames RMS (%.1f maximum), residual jitter %.1f frames RMS, "
+         "%.1f frames (%.0f us) maximum.",
+         position_source_names[source], median_step, smallest_step, backward_steps,
+         backward_steps == 1 ? "" : "s", error_rms, error_maximum, jitter_rms, jitter_maximum,
+         jitter_maximum * 1000000.0 / rate);
+  free(positions);
+  free(times);
+  free(steps);
+  // a constant offset and a steady drift are taken care of by the player's synchronisation, so it's
+  // the residual jitter that decides whether the position can be used directly
+  return (step_count == 0) || (backward_steps != 0) ||
+         (median_step > MEASURE_INTERPOLATION_THRESHOLD * rate) ||
+         (jitter_maximum > MEASURE_INTERPOLATION_THRESHOLD * rate);
+}
+
+static void measure_position(const char *device_name, snd_pcm_format_t format, unsigned int rate) {
+  position_samples *p = malloc(sizeof(position_samples));
+  if (p == NULL)
+    die("can not allocate memory to measure position reporting.");
+  measure_stream s;
+  int ret = measure_stream_open(&s, device_name, format, rate, NULL);
+  if (ret == 0) {
+    ret = measure_position_sample(&s, p);
+    measure_stream_close(&s);
+  }
+  if ((ret != 0) || (p->count < 2)) {
+    inform("    Position Reporting: not measured -- playing failed.");
+  } else {
+    inform("    Position Reporting, sampled every %.2f ms for %.0f s, error against the position "
+           "expected at %u frames per second, and residual jitter once the offset and drift of "
+           "the device's clock are fitted out:",
+           MEASURE_POSITION_INTERVAL * 1000, MEASURE_PLAY_TIME, rate);
+    int interpolation_needed = 0;
+    position_source source;
+    for (source = 0; source < POSITION_SOURCE_COUNT; source++)
+      interpolation_needed |= measure_position_report(p, source, rate);
+    if (interpolation_needed != 0)
+      inform("    Interpolation is needed -- the position is updated too coarsely, too "
+             "inaccurately or inconsistently to be used directly.");
+    else
+      inform("    Interpolation is not needed -- the position is updated at least every %.0f ms "
+             "and its residual jitter is no more than that.",
+             MEASURE_INTERPOLATION_THRESHOLD * 1000);
+  }
+  free(p);
+}
+
+// how long to wait for an underrun, or for the first frame after one, beyond the buffer's length
+#define MEASURE_XRUN_TIMEOUT 1.0
+
+// Sleep until the position has moved past a frame, keeping the buffer full.
+// Returns 0, -ETIMEDOUT, or a negative ALSA error code.
+static int measure_wait_for_position(measure_stream *s, uint64_t frame) {
+  struct timespec interval = {0, (long)(MEASURE_POSITION_INTERVAL * 1000000000)};
+  double timeout = measure_time_now(CLOCK_MONOTONIC) + (double)s->buffer_size / s->rate +
+                   MEASURE_XRUN_TIMEOUT;
+  while (measure_time_now(CLOCK_MONOTONIC) < timeout) {
+    snd_pcm_sframes_t delay;
+    int ret = snd_pcm_delay(s->handle, &delay);
+    if (ret < 0)
+      return ret;
+    // a negative delay means the hardware pointer has run past what has been written, e.g. when
+    // free-running, so the frame hasn't been played yet -- only skipped
+    if ((delay >= 0) && (s->frames_written - delay > frame))
+      return 0;
+    snd_pcm_sframes_t avail;
+    while ((avail = snd_pcm_avail_update(s->handle)) >= (snd_pcm_sframes_t)s->period_size) {
+      snd_pcm_sframes_t written = measure_stream_write(s);
+      if (written < 0)
+        return written;
+    }
+    nanosleep(&interval, NULL);
+  }
+  return -ETIMEDOUT;
+}
+
+// Stop writing to a playing stream until it underruns -- or, if it's free-running, until the
+// hardware pointer has passed the last frame written -- then resume, timing the recovery and the
+// time until the first frame written after resuming is played.
+// Returns 0 or a negative error code.
+static int measure_xrun_recovery(measure_stream *s, int free_running, double *recovery_time,
+                                 double *first_frame_time) {
+  struct timespec interval = {0, 1000000};
+  double timeout = measure_time_now(CLOCK_MONOTONIC) + (double)s->buffer_size / s->rate +
+                   MEASURE_XRUN_TIMEOUT;
+  snd_pcm_sframes_t avail;
+  do {
+    nanosleep(&interval, NULL);
+    avail = snd_pcm_avail(s->handle);
+    if (measure_time_now(CLOCK_MONOTONIC) > timeout)
+      return -ETIMEDOUT;
+  } while ((free_running == 0) ? (avail >= 0)
+                               : ((avail >= 0) &&
+                                  (avail <= (snd_pcm_sframes_t)(s->buffer_size + s->period_size))));
+  if ((avail < 0) && (avail != -EPIPE))
+    return avail;
+  double start_time = measure_time_now(CLOCK_MONOTONIC);
+  uint64_t first_frame = 0; // the first frame written after resuming
+  int ret;
+  if (free_running == 0) {
+    ret = snd_pcm_recover(s->handle, -EPIPE, 1);
+    *recovery_time = measure_time_now(CLOCK_MONOTONIC) - start_time;
+    if (ret == 0)
+      ret = measure_stream_fill_and_start(s); // counting frames from zero again
+  } else {
+    // skip over what has been played past the last frame written
+    snd_pcm_sframes_t skipped = snd_pcm_forward(s->handle, avail - s->buffer_size);
+    *recovery_time = measure_time_now(CLOCK_MONOTONIC) - start_time;
+    ret = skipped < 0 ? (int)skipped : 0;
+    if (ret == 0)
+      s->frames_written += skipped;
+    first_frame = s->frames_written;
+  }
+  if (ret == 0)
+    ret = measure_wait_for_position(s, first_frame);
+  *first_frame_time = measure_time_now(CLOCK_MONOTONIC) - start_time;
+  return ret;
+}
+
+static void measure_xrun_report(const char *title, double *recovery_times,
+                                double *first_frame_times, int runs) {
+  inform("      %-21srecovery:    median %.2f ms, 90th percentile %.2f ms, maximum %.2f ms;", title,
+         measure_percentile(recovery_times, runs, 50) * 1000,
+         measure_percentile(recovery_times, runs, 90) * 1000,
+         measure_percentile(recovery_times, runs, 100) * 1000);
+  inform("      %-21sfirst frame: median %.1f ms, 90th percentile %.1f ms, maximum %.1f ms.", "",
+         measure_percentile(first_frame_times, runs, 50) * 1000,
+         measure_percentile(first_frame_times, runs, 90) * 1000,
+         measure_percentile(first_frame_times, runs, 100) * 1000);
+}
+
+// Cause underruns by stopping writes and time the recovery from them, with the stream stopping at
+// an underrun, as it does by default, and, if the device allows it, with it free-running.
+static void measure_xrun_recoveries(const char *device_name, snd_pcm_format_t format,
+                                    unsigned int rate, measurement_summary *summary) {
+  int runs = measurements.xrun_runs;
+  double *recovery_times = malloc(runs * sizeof(double));
+  double *first_frame_times = malloc(runs * sizeof(double));
+  if ((recovery_times == NULL) || (first_frame_times == NULL))
+    die("can not allocate memory to measure underrun recovery.");
+  inform("    Underrun Recovery, %d underruns caused by stopping writes:", runs);
+  int free_running;
+  for (free_running = 0; free_running <= 1; free_running++) {
+    const char *title = free_running != 0 ? "Free-running:" : "Stopping (default):";
+    alsa_device_settings settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.explicit_start = 1;
+    settings.free_running = free_running;
+    measure_stream s;
+    int ret = measure_stream_open(&s, device_name, format, rate, &settings);
+    if (ret != 0) {
+      // only the software parameters being rejected says the device can't run freely
+      if ((free_running != 0) && (ret == -SPS_EXPLORE_STATUS_DEVICE_CANT_SET_SW_PARAMS) &&
+          (s.alsa_error == -EINVAL))
+        inform("      %-21snot supported -- the stop threshold can not be set to the boundary.",
+               title);
+      else
+        inform("      %-21snot measured -- the device can not be set up: %s.", title,
+               snd_strerror(s.alsa_error));
+      continue;
+    }
+    ret = measure_stream_start(&s);
+    if (ret == 0)
+      ret = measure_wait_for_position(&s, 0);
+    int run;
+    for (run = 0; (run < runs) && (ret == 0); run++)
+      ret = measure_xrun_recovery(&s, free_running, &recovery_times[run], &first_frame_times[run]);
+    measure_stream_close(&s);
+    if (ret == 0) {
+      measure_xrun_report(title, recovery_times, first_frame_times, runs);
+      if (free_running == 0)
+        summary->recovery_time = measure_percentile(first_frame_times, runs, 50);
+    } else
+      inform("      %-21snot measured -- %s.", title,
+             ret == -ETIMEDOUT ? "the device did not respond as expected" : snd_strerror(ret));
+  }
+  free(first_frame_times);
+  free(recovery_times);
+}
+
+// positions are ignored for this long after starting, while the devices settle
+#define MEASURE_DRIFT_SETTLE_TIME 1.0
+// devices whose clocks drift apart by less than this are taken to share a clock
+#define MEASURE_SAME_CLOCK_PPM 1.0
+
+typedef struct {
+  measure_stream stream;
+  const char *device_name;
+  struct pollfd *fds; // in the array polled for all the streams
+  snd_pcm_sframes_t last_position;
+  int failed;
+  // sums for a least-squares fit of the position against the time
+  double n, st, sp, stt, stp;
+} drift_stream;
+
+// frames per second, by the monotonic clock
+static double drift_stream_rate(const drift_stream *d) {
+  double denominator = d->n * d->stt - d->st * d->st;
+  return denominator != 0.0 ? (d->n * d->stp - d->st * d->sp) / denominator : 0.0;
+}
+
+// Note the position whenever it changes, and keep the buffer full.
+static void drift_stream_service(drift_stream *d, double time) {
+  snd_pcm_t *handle = d->stream.handle;
+  unsigned short revents;
+  if ((snd_pcm_poll_descriptors_revents(handle, d->fds, d->stream.fd_count, &revents) < 0) ||
+      (revents & POLLERR)) {
+    d->failed = 1;
+    return;
+  }
+  snd_pcm_sframes_t delay;
+  if ((time >= MEASURE_DRIFT_SETTLE_TIME) && (snd_pcm_delay(handle, &delay) == 0)) {
+    snd_pcm_sframes_t position = d->stream.frames_written - delay;
+    if (position != d->last_position) {
+      d->last_position = position;
+      d->n += 1;
+      d->st += time;
+      d->sp += position;
+      d->stt += time * time;
+      d->stp += time * position;
+    }
+  }
+  snd_pcm_sframes_t avail = snd_pcm_avail_update(handle);
+  while ((d->failed == 0) && (avail >= (snd_pcm_sframes_t)d->stream.period_size)) {
+    if (measure_stream_write(&d->stream) < 0)
+      d->failed = 1;
+    else
+      avail = snd_pcm_avail_update(handle);
+  }
+  if (avail < 0)
+    d->failed = 1;
+}
+
+void measure_drift(const char **device_names, const snd_pcm_format_t *formats, int device_count,
+                   unsigned int rate, double seconds) {
+  drift_stream *streams = calloc(device_count, sizeof(drift_stream));
+  if (streams == NULL)
+    die("can not allocate memory to measure clock drift.");
+  int i, j, fd_count = 0;
+  for (i = 0; i < device_count; i++) {
+    streams[i].device_name = device_names[i];
+    if (measure_stream_open(&streams[i].stream, device_names[i], formats[i], rate, NULL) != 0)
+      streams[i].failed = 1;
+    else
+      fd_count += streams[i].stream.fd_count;
+  }
+  struct pollfd *fds = calloc(fd_count + 1, sizeof(struct pollfd));
+  if (fds == NULL)
+    die("can not allocate memory to measure clock drift.");
+  fd_count = 0;
+  for (i = 0; i < device_count; i++) {
+    drift_stream *d = &streams[i];
+    if (d->failed != 0)
+      continue;
+    d->fds = &fds[fd_count];
+    memcpy(d->fds, d->stream.fds, d->stream.fd_count * sizeof(struct pollfd));
+    fd_count += d->stream.fd_count;
+    if (measure_stream_start(&d->stream) != 0) {
+      d->failed = 1;
+      for (j = 0; j < d->stream.fd_count; j++)
+        d->fds[j].fd = -1;
+    }
+  }
+  inform("Clock Drift, playing to %d devices at %u frames per second for %.0f s:", device_count,
+         rate, seconds);
+  double start_time = measure_time_now(CLOCK_MONOTONIC);
+  double time = 0.0;
+  while (time < seconds) {
+    // wake often, to see the positions change promptly whatever their granularity
+    if (poll(fds, fd_count, 1) < 0)
+      break;
+    time = measure_time_now(CLOCK_MONOTONIC) - start_time;
+    for (i = 0; i < device_count; i++) {
+      drift_stream *d = &streams[i];
+      if ((d->failed == 0) && (d->fds != NULL)) {
+        drift_stream_service(d, time);
+        if (d->failed != 0) { // stop polling it
+          for (j = 0; j < d->stream.fd_count; j++)
+            d->fds[j].fd = -1;
+        }
+      }
+    }
+  }
+  double *rates = calloc(device_count, sizeof(double));
+  if (rates == NULL)
+    die("can not allocate memory to measure clock drift.");
+  for (i = 0; i < device_count; i++) {
+    drift_stream *d = &streams[i];
+    if ((d->failed == 0) && (d->n >= 10))
+      rates[i] = drift_stream_rate(d);
+    if (rates[i] > 0.0)
+      inform("  [%d] %-40s %+8.2f ppm against the system clock.", i + 1, d->device_name,
+             (rates[i] / rate - 1.0) * 1000000.0);
+    else
+      inform("  [%d] %-40s not measured -- %s.", i + 1, d->device_name,
+             d->stream.handle == NULL ? "it can not be opened" : "playing failed");
+    measure_stream_close(&d->stream);
+  }
+  inform("  Drift in ppm of each device (row) against each other device (column):");
+  char line[1024];
+  int length = snprintf(line, sizeof(line), "      ");
+  for (j = 0; j < device_count; j++)
+    length += snprintf(line + length, sizeof(line) - length, "%9s[%d]", "", j + 1);
+  inform("%s", line);
+  for (i = 0; i < device_count; i++) {
+    length = snprintf(line, sizeof(line), "  [%d] ", i + 1);
+    for (j = 0; (j < device_count) && (length < (int)sizeof(line)); j++) {
+      if ((i == j) || (rates[i] == 0.0) || (rates[j] == 0.0))
+        length += snprintf(line + length, sizeof(line) - length, "%12s", "-");
+      else
+        length += snprintf(line + length, sizeof(line) - length, "%+12.2f",
+                           (rates[i] / rates[j] - 1.0) * 1000000.0);
+    }
+    inform("%s", line);
+  }
+  // group the devices into clock domains
+  int *domain = calloc(device_count, sizeof(int));
+  if (domain == NULL)
+    die("can not allocate memory to measure clock drift.");
+  for (i = 0; i < device_count; i++) {
+    if ((rates[i] == 0.0) || (domain[i] != 0))
+      continue;
+    domain[i] = i + 1;
+    length = snprintf(line, sizeof(line), "[%d]", i + 1);
+    int members = 1;
+    for (j = i + 1; j < device_count; j++)
+      if ((rates[j] != 0.0) && (domain[j] == 0) &&
+          (fabs(rates[i] / rates[j] - 1.0) * 1000000.0 < MEASURE_SAME_CLOCK_PPM)) {
+        domain[j] = i + 1;
+        members++;
+        if (length < (int)sizeof(line))
+          length += snprintf(line + length, sizeof(line) - length, ", [%d]", j + 1);
+      }
+    if (members > 1)
+      inform("  Devices %s drift apart by less than %.1f ppm, so they seem to share a clock.", line,
+             MEASURE_SAME_CLOCK_PPM);
+  }
+  inform(""); // newline
+  free(domain);
+  free(rates);
+  free(fds);
+  free(streams);
+}
+
+int measurements_requested(void) {
+  return (measurements.timestamps != 0) || (measurements.startup_runs != 0) ||
+         (measurements.rate_switch_runs != 0) || (measurements.period_size_count != 0) ||
+         (measurements.stress != 0) || (measurements.position != 0) ||
+         (measurements.xrun_runs != 0);
+}
+
+void measure_device(const char *device_name, snd_pcm_format_t format, unsigned int rate,
+                    const unsigned int *rates, int rate_count, measurement_summary *summary) {
+  memset(summary, 0, sizeof(measurement_summary));
+  summary->underruns = -1;
+  inform("  Measurements, playing silence at %u frames per second in the %s format:", rate,
+         snd_pcm_format_name(format));
+  if (measurements.timestamps != 0)
+    measure_timestamps(device_name, format, rate);
+  if (measurements.startup_runs != 0)
+    measure_startup(device_name, format, rate, summary);
+  if (measurements.rate_switch_runs != 0)
+    measure_rate_switching(device_name, format, rates, rate_count);
+  if (measurements.period_size_count != 0)
+    measure_period_sizes(device_name, format, rate);
+  if (measurements.stress != 0)
+    measure_under_load(device_name, format, rate, summary);
+  if (measurements.position != 0)
+    measure_position(device_name, format, rate);
+  if (measurements.xrun_runs != 0)
+    measure_xrun_recoveries(device_name, format, rate, summary);
+}
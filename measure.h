@@ -0,0 +1,73 @@
+/*
+ * This file is part of the sps-alsa-explore distribution
+ * (https://github.com/mikebrady/sps-alsa-explore). Copyright (c) 2021-2024 Mike Brady.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Commercial licensing is also available.
+ */
+
+
+#ifndef _MEASURE_H
+#define _MEASURE_H
+
+// Measurements made by playing silence to each usable device.
+
+#include <alsa/asoundlib.h>
+
+#define MEASURE_MAX_PERIOD_SIZES 16
+
+// the default time a device is left idle before each run of the idle startup measurement -- long
+// enough for it to power down, e.g. with snd_hda_intel's power_save or USB autosuspend
+#define MEASURE_DEFAULT_IDLE_TIME 5
+
+// the measurements requested on the command line
+typedef struct {
+  int timestamps;   // the timestamp types supported and the jitter of the timestamps
+  int startup_runs; // if nonzero, measure the time to the first frame this many times
+  int startup_idle_time; // in seconds before each run after idling, zero to skip those runs
+  int rate_switch_runs; // if nonzero, switch between each pair of rates this many times each way
+  snd_pcm_uframes_t period_sizes[MEASURE_MAX_PERIOD_SIZES]; // to profile, in ascending order
+  int period_size_count;
+  int position;         // the granularity, consistency and accuracy of the position reported
+  int stress;           // if nonzero, play with other threads loading the CPU and memory
+  int stress_threads;   // zero for one on each of the other cores
+  int stress_megabytes; // swept by the threads, zero for a load on the CPU alone
+  int xrun_runs;        // if nonzero, cause this many underruns and time the recovery from each
+} measurement_options;
+
+extern measurement_options measurements;
+
+// returns nonzero if any measurement has been requested
+int measurements_requested(void);
+
+// What the measurements found that bears on the choice of a device
+typedef struct {
+  double startup_time;  // median time to the first frame from closed, zero if not measured
+  int underruns;        // under load at normal priority, negative if not measured
+  double recovery_time; // median time to the first frame after an underrun, zero if not measured
+} measurement_summary;
+
+// Make the measurements requested on a usable device, in the format and at the rate that
+// Shairport Sync would choose, report the results and summarise them.
+// rates are all the rates the device accepts in that format, in ascending order.
+void measure_device(const char *device_name, snd_pcm_format_t format, unsigned int rate,
+                    const unsigned int *rates, int rate_count, measurement_summary *summary);
+
+// Play to all the devices at once, at the same rate, each in its own format, for the time given.
+// Report the drift of each device's clock against the system's monotonic clock and against the
+// other devices', and which devices seem to share a clock.
+void measure_drift(const char **device_names, const snd_pcm_format_t *formats, int device_count,
+                   unsigned int rate, double seconds);
+
+#endif /* _MEASURE_H */
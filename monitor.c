@@ -0,0 +1,453 @@
+/*
+ * This file is part of the sps-alsa-explore distribution
+ * (https://github.com/mikebrady/sps-alsa-explore). Copyright (c) 2021-2024 Mike Brady.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Commercial licensing is also available.
+ */
+
+#include "monitor.h"
+#include "procfs.h"
+#include "sps-alsa-explore.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Cards can come and go, e.g. USB DACs, so look for them again this often.
+#define MONITOR_ENUMERATION_INTERVAL 60.0
+
+typedef struct {
+  int card_number;
+  int dev;
+  int sub_device;
+  char device_name[128];
+  int present; // found at the last enumeration
+  int last_valid;
+  proc_asound_substream last; // the previous sample
+  uint64_t frames_written; // progress of the application pointer
+  uint64_t frames_played;  // progress of the hardware pointer
+  uint64_t xruns;
+  uint64_t starts; // includes restarts after underruns too brief to be sampled
+  uint64_t stalls; // samples in which a running substream's hardware pointer didn't move
+  uint64_t state_changes;
+  uint64_t opens;
+} monitored_substream;
+
+static monitored_substream *substreams = NULL;
+static int substream_count = 0;
+static uint64_t samples_taken = 0;
+static volatile sig_atomic_t monitor_stop_requested = 0;
+
+static const char *pcm_state_names[] = {"OPEN",   "SETUP",  "PREPARED",  "RUNNING",     "XRUN",
+                                        "DRAINING", "PAUSED", "SUSPENDED", "DISCONNECTED"};
+
+static void monitor_stop_handler(__attribute__((unused)) int signal_number) {
+  monitor_stop_requested = 1;
+}
+
+static double monitor_time_now(void) {
+  struct timespec tn;
+  clock_gettime(CLOCK_MONOTONIC, &tn);
+  return tn.tv_sec + tn.tv_nsec * 0.000000001;
+}
+
+static void monitor_add_device(const playback_device *d, __attribute__((unused)) void *context) {
+  // every subdevice of the device is monitored
+  int sub_device_count = d->sub_device_count > 0 ? d->sub_device_count : 1;
+  int first_sub_device = check_subdevices != 0 ? d->sub_device : 0;
+  int last_sub_device = check_subdevices != 0 ? d->sub_device : sub_device_count - 1;
+  int s;
+  for (s = first_sub_device; s <= last_sub_device; s++) {
+    int i;
+    for (i = 0; i < substream_count; i++) {
+      if ((substreams[i].card_number == d->card_number) && (substreams[i].dev == d->dev) &&
+          (substreams[i].sub_device == s))
+        break;
+    }
+    if (i == substream_count) {
+      monitored_substream *enlarged =
+          realloc(substreams, (substream_count + 1) * sizeof(monitored_substream));
+      if (enlarged == NULL)
+        die("can not allocate memory to monitor \"%s\".", d->device_name);
+      substreams = enlarged;
+      memset(&substreams[i], 0, sizeof(monitored_substream));
+      substreams[i].card_number = d->card_number;
+      substreams[i].dev = d->dev;
+      substreams[i].sub_device = s;
+      snprintf(substreams[i].device_name, sizeof(substreams[i].device_name), "%s",
+               d->device_name);
+      substream_count++;
+      debug(1, "monitoring card %d, device %d, subdevice %d (\"%s\").", d->card_number, d->dev, s,
+            d->device_name);
+    }
+    substreams[i].present = 1;
+  }
+}
+
+static void monitor_enumerate(void) {
+  int i;
+  for (i = 0; i < substream_count; i++)
+    substreams[i].present = 0;
+  enumerate_playback_devices(monitor_add_device, NULL);
+}
+
+// The progress of a pointer since the last sample. The pointers wrap to zero at the boundary, so
+// a step backwards from within a buffer's length of it is a wrap; any other step backwards means
+// the substream was set up again, or closed and reopened, between samples, and so reset is set
+// and only the new position counts.
+static unsigned long monitor_pointer_progress(unsigned long pointer, unsigned long last_pointer,
+                                              const proc_asound_substream *last, int *reset) {
+  if (pointer >= last_pointer)
+    return pointer - last_pointer;
+  if ((last->boundary > last_pointer) && (last->boundary - last_pointer <= last->buffer_size))
+    return last->boundary - last_pointer + pointer;
+  *reset = 1;
+  return pointer;
+}
+
+static void monitor_sample(monitored_substream *m) {
+  proc_asound_substream s;
+  if ((m->present == 0) || (proc_asound_substream_read(m->card_number, m->dev, m->sub_device,
+                                                       SND_PCM_STREAM_PLAYBACK, &s) != 0)) {
+    m->last_valid = 0;
+    return;
+  }
+  if (m->last_valid != 0) {
+    const proc_asound_substream *l = &m->last;
+    if ((s.setup != PROC_ASOUND_SUBSTREAM_CLOSED) && (l->setup == PROC_ASOUND_SUBSTREAM_CLOSED))
+      m->opens++;
+    if ((s.setup == PROC_ASOUND_SUBSTREAM_SETUP) && (l->setup == PROC_ASOUND_SUBSTREAM_SETUP)) {
+      if (strcmp(s.state, l->state) != 0) {
+        m->state_changes++;
+        if (strcmp(s.state, "XRUN") == 0)
+          m->xruns++;
+      }
+      if (s.trigger_time != l->trigger_time)
+        m->starts++;
+      int reset = 0;
+      unsigned long progress = monitor_pointer_progress(s.hw_ptr, l->hw_ptr, l, &reset);
+      m->frames_played += progress;
+      m->frames_written += monitor_pointer_progress(s.appl_ptr, l->appl_ptr, l, &reset);
+      if (reset != 0)
+        m->opens++; // or set up again, which is as good as a new open
+      if ((progress == 0) && (strcmp(s.state, "RUNNING") == 0) &&
+          (strcmp(l->state, "RUNNING") == 0))
+        m->stalls++;
+    }
+  }
+  m->last = s;
+  m->last_valid = 1;
+}
+
+typedef enum {
+  METRIC_OPEN = 0,
+  METRIC_RATE,
+  METRIC_BUFFER_SIZE,
+  METRIC_PERIOD_SIZE,
+  METRIC_DELAY,
+  METRIC_AVAIL,
+  METRIC_AVAIL_MAX,
+  METRIC_OWNER_PID,
+  METRIC_FRAMES_WRITTEN,
+  METRIC_FRAMES_PLAYED,
+  METRIC_XRUNS,
+  METRIC_STARTS,
+  METRIC_STALLS,
+  METRIC_STATE_CHANGES,
+  METRIC_OPENS,
+  METRIC_COUNT,
+} monitor_metric;
+
+static const struct {
+  const char *name;
+  const char *type;
+  const char *help;
+} metric_descriptions[METRIC_COUNT] = {
+    {"sps_alsa_pcm_open", "gauge", "Whether the playback substream is open."},
+    {"sps_alsa_pcm_rate_hz", "gauge", "Frame rate of the open substream."},
+    {"sps_alsa_pcm_buffer_size_frames", "gauge", "Buffer size of the open substream."},
+    {"sps_alsa_pcm_period_size_frames", "gauge", "Period size of the open substream."},
+    {"sps_alsa_pcm_delay_frames", "gauge", "Delay reported for the open substream."},
+    {"sps_alsa_pcm_avail_frames", "gauge", "Frames available to be written."},
+    {"sps_alsa_pcm_avail_max_frames", "gauge", "Most frames available since last reported."},
+    {"sps_alsa_pcm_owner_pid", "gauge", "Process that opened the substream, if known."},
+    {"sps_alsa_pcm_frames_written_total", "counter",
+     "Application pointer progress while sampled."},
+    {"sps_alsa_pcm_frames_played_total", "counter", "Hardware pointer progress while sampled."},
+    {"sps_alsa_pcm_xruns_total", "counter", "Transitions into the XRUN state seen."},
+    {"sps_alsa_pcm_starts_total", "counter",
+     "Starts seen, including restarts after underruns too brief to be sampled."},
+    {"sps_alsa_pcm_stalls_total", "counter",
+     "Samples in which the hardware pointer of a running substream didn't move."},
+    {"sps_alsa_pcm_state_changes_total", "counter", "State changes seen."},
+    {"sps_alsa_pcm_opens_total", "counter", "Times the substream was seen to be opened."},
+};
+
+// returns 0 if the metric has a value for the substream
+static int monitor_metric_value(const monitored_substream *m, monitor_metric metric,
+                                double *value) {
+  const proc_asound_substream *s = &m->last;
+  int is_set_up = (m->last_valid != 0) && (s->setup == PROC_ASOUND_SUBSTREAM_SETUP);
+  switch (metric) {
+  case METRIC_OPEN:
+    if (m->last_valid == 0)
+      return -1;
+    *value = s->setup != PROC_ASOUND_SUBSTREAM_CLOSED;
+    return 0;
+  case METRIC_RATE:
+    *value = s->rate;
+    return is_set_up ? 0 : -1;
+  case METRIC_BUFFER_SIZE:
+    *value = s->buffer_size;
+    return is_set_up ? 0 : -1;
+  case METRIC_PERIOD_SIZE:
+    *value = s->period_size;
+    return is_set_up ? 0 : -1;
+  case METRIC_DELAY:
+    *value = s->delay;
+    return is_set_up ? 0 : -1;
+  case METRIC_AVAIL:
+    *value = s->avail;
+    return is_set_up ? 0 : -1;
+  case METRIC_AVAIL_MAX:
+    *value = s->avail_max;
+    return is_set_up ? 0 : -1;
+  case METRIC_OWNER_PID:
+    *value = s->owner_pid;
+    return (is_set_up && (s->owner_pid > 0)) ? 0 : -1;
+  case METRIC_FRAMES_WRITTEN:
+    *value = m->frames_written;
+    return 0;
+  case METRIC_FRAMES_PLAYED:
+    *value = m->frames_played;
+    return 0;
+  case METRIC_XRUNS:
+    *value = m->xruns;
+    return 0;
+  case METRIC_STARTS:
+    *value = m->starts;
+    return 0;
+  case METRIC_STALLS:
+    *value = m->stalls;
+    return 0;
+  case METRIC_STATE_CHANGES:
+    *value = m->state_changes;
+    return 0;
+  case METRIC_OPENS:
+    *value = m->opens;
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+static void monitor_write_labels(FILE *f, const monitored_substream *m) {
+  fprintf(f, "card=\"%d\",device=\"%d\",subdevice=\"%d\",name=\"%s\"", m->card_number, m->dev,
+          m->sub_device, m->device_name);
+}
+
+static void monitor_write_metrics(FILE *f, double cpu_seconds) {
+  int metric, i;
+  for (metric = 0; metric < METRIC_COUNT; metric++) {
+    fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", metric_descriptions[metric].name,
+            metric_descriptions[metric].help, metric_descriptions[metric].name,
+            metric_descriptions[metric].type);
+    for (i = 0; i < substream_count; i++) {
+      double value;
+      if (monitor_metric_value(&substreams[i], metric, &value) == 0) {
+        fprintf(f, "%s{", metric_descriptions[metric].name);
+        monitor_write_labels(f, &substreams[i]);
+        fprintf(f, "} %.0f\n", value);
+      }
+    }
+  }
+  // the state is given as a label, with 1 for the current state and 0 for the others
+  fprintf(f, "# HELP sps_alsa_pcm_state State of the open substream.\n"
+             "# TYPE sps_alsa_pcm_state gauge\n");
+  for (i = 0; i < substream_count; i++) {
+    const monitored_substream *m = &substreams[i];
+    if ((m->last_valid == 0) || (m->last.setup != PROC_ASOUND_SUBSTREAM_SETUP))
+      continue;
+    size_t n;
+    for (n = 0; n < sizeof(pcm_state_names) / sizeof(pcm_state_names[0]); n++) {
+      fprintf(f, "sps_alsa_pcm_state{");
+      monitor_write_labels(f, m);
+      fprintf(f, ",state=\"%s\"} %d\n", pcm_state_names[n],
+              strcmp(m->last.state, pcm_state_names[n]) == 0);
+    }
+  }
+  fprintf(f,
+          "# HELP sps_alsa_monitor_samples_total Samples taken by the monitor.\n"
+          "# TYPE sps_alsa_monitor_samples_total counter\n"
+          "sps_alsa_monitor_samples_total %" PRIu64 "\n"
+          "# HELP sps_alsa_monitor_cpu_seconds_total CPU time used by the monitor.\n"
+          "# TYPE sps_alsa_monitor_cpu_seconds_total counter\n"
+          "sps_alsa_monitor_cpu_seconds_total %.6f\n",
+          samples_taken, cpu_seconds);
+}
+
+static double monitor_cpu_seconds(void) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0.0;
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 0.000001 + usage.ru_stime.tv_sec +
+         usage.ru_stime.tv_usec * 0.000001;
+}
+
+// write the metrics to a temporary file and rename it, so that readers never see a partial file
+static int monitor_write_file(const char *path, const char *text, size_t text_length) {
+  char temporary_path[4096];
+  snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+  FILE *f = fopen(temporary_path, "w");
+  if (f == NULL) {
+    int result = -errno; // before warn() can change it
+    warn("can not write metrics to \"%s\": %s.", temporary_path, strerror(-result));
+    return result;
+  }
+  int result = 0;
+  if ((fwrite(text, 1, text_length, f) != text_length) || (fclose(f) != 0)) {
+    warn("error writing metrics to \"%s\": %s.", temporary_path, strerror(errno));
+    result = -EIO;
+  } else if (rename(temporary_path, path) != 0) {
+    result = -errno;
+    warn("can not rename \"%s\" to \"%s\": %s.", temporary_path, path, strerror(-result));
+  }
+  return result;
+}
+
+static int monitor_open_socket(const char *path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    warn("the socket path \"%s\" is too long.", path);
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    warn("can not create a socket: %s.", strerror(errno));
+    return -1;
+  }
+  unlink(path); // left over from a previous run
+  if ((bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) || (listen(fd, 8) != 0)) {
+    warn("can not listen on \"%s\": %s.", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void monitor_serve_client(int listening_fd, const char *text, size_t text_length) {
+  int fd = accept(listening_fd, NULL, NULL);
+  if (fd >= 0) {
+    size_t written = 0;
+    while (written < text_length) {
+      ssize_t n = write(fd, text + written, text_length - written);
+      if (n <= 0)
+        break;
+      written += n;
+    }
+    close(fd);
+  }
+}
+
+int monitor_playback_devices(double interval, const char *destination) {
+  int listening_fd = -1;
+  const char *socket_path = NULL;
+  if (strncmp(destination, "unix:", strlen("unix:")) == 0) {
+    socket_path = destination + strlen("unix:");
+    listening_fd = monitor_open_socket(socket_path);
+    if (listening_fd < 0)
+      return -1;
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = monitor_stop_handler;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN); // clients may go away before being served
+
+  monitor_enumerate();
+  inform("Monitoring %d playback substream%s every %.3g seconds. Metrics are %s \"%s\".",
+         substream_count, substream_count == 1 ? "" : "s", interval,
+         socket_path != NULL ? "served on the Unix socket" : "written to",
+         socket_path != NULL ? socket_path : destination);
+
+  char *text = NULL;
+  size_t text_length = 0;
+  double time_of_last_enumeration = monitor_time_now();
+  double time_of_next_sample = time_of_last_enumeration;
+  int result = 0;
+  while (monitor_stop_requested == 0) {
+    double time_now = monitor_time_now();
+    if (time_now >= time_of_next_sample) {
+      if (time_now - time_of_last_enumeration >= MONITOR_ENUMERATION_INTERVAL) {
+        monitor_enumerate();
+        time_of_last_enumeration = time_now;
+      }
+      int i;
+      for (i = 0; i < substream_count; i++)
+        monitor_sample(&substreams[i]);
+      samples_taken++;
+      free(text);
+      text = NULL;
+      FILE *f = open_memstream(&text, &text_length);
+      if (f == NULL)
+        die("can not allocate memory for the metrics.");
+      monitor_write_metrics(f, monitor_cpu_seconds());
+      fclose(f);
+      if ((socket_path == NULL) && (monitor_write_file(destination, text, text_length) != 0)) {
+        result = -1;
+        break;
+      }
+      time_of_next_sample = time_of_next_sample + interval;
+      if (time_of_next_sample < time_now) // fallen behind, e.g. after a suspend
+        time_of_next_sample = time_now + interval;
+      continue;
+    }
+    // wait for the next sample, serving the metrics to any client that connects meanwhile
+    int timeout_ms = (int)((time_of_next_sample - time_now) * 1000) + 1;
+    if (listening_fd >= 0) {
+      struct pollfd pfd = {listening_fd, POLLIN, 0};
+      if ((poll(&pfd, 1, timeout_ms) > 0) && (pfd.revents & POLLIN) && (text != NULL))
+        monitor_serve_client(listening_fd, text, text_length);
+    } else {
+      poll(NULL, 0, timeout_ms);
+    }
+  }
+
+  if (listening_fd >= 0) {
+    close(listening_fd);
+    unlink(socket_path);
+  }
+  free(text);
+  free(substreams);
+  substreams = NULL;
+  substream_count = 0;
+  debug(1, "monitor stopped after %" PRIu64 " samples, using %.3f seconds of CPU time.",
+        samples_taken, monitor_cpu_seconds());
+  return result;
+}
@@ -0,0 +1,30 @@
+/*
+ * This file is part of the sps-alsa-explore distribution
+ * (https://github.com/mikebrady/sps-alsa-explore). Copyright (c) 2021-2024 Mike Brady.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Commercial licensing is also available.
+ */
+
+#ifndef _MONITOR_H
+#define _MONITOR_H
+
+// Sample the state of every playback substream from /proc/asound every interval seconds, without
+// opening any of them, and publish counters and gauges in the Prometheus text format.
+// If destination is "unix:PATH", the metrics are served to clients connecting to a Unix socket at
+// PATH, otherwise destination is a file that is replaced at every sample.
+// Runs until interrupted; returns 0 if it stopped normally.
+int monitor_playback_devices(double interval, const char *destination);
+
+#endif /* _MONITOR_H */
@@ -0,0 +1,547 @@
+/*
+ * This file is part of the sps-alsa-explore distribution
+ * (https://github.com/mikebrady/sps-alsa-explore). Copyright (c) 2021-2024 Mike Brady.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Commercial licensing is also available.
+ */
+
+#include "procfs.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char proc_asound_stream_letter(snd_pcm_stream_t stream) {
+  return stream == SND_PCM_STREAM_PLAYBACK ? 'p' : 'c';
+}
+
+// split a "key: value" line in place, trimming whitespace from both parts.
+// returns 0 if the line contains a key and a value
+static int proc_asound_split_line(char *line, char **key, char **value) {
+  char *colon = strchr(line, ':');
+  if (colon == NULL)
+    return -1;
+  *colon = '\0';
+  char *p = colon - 1;
+  while ((p >= line) && isspace((unsigned char)*p))
+    *p-- = '\0';
+  p = colon + 1;
+  while (isspace((unsigned char)*p))
+    p++;
+  *value = p;
+  p = p + strlen(p);
+  while ((p > *value) && isspace((unsigned char)*(p - 1)))
+    *--p = '\0';
+  *key = line;
+  return 0;
+}
+
+static void proc_asound_copy_value(char *destination, size_t size, const char *value) {
+  strncpy(destination, value, size - 1);
+  destination[size - 1] = '\0';
+}
+
+// open one of the files of a substream, e.g. "hw_params".
+// returns NULL (and sets errno) if the file can't be opened.
+static FILE *proc_asound_open_substream_file(int card_number, int device_number,
+                                             int subdevice_number, snd_pcm_stream_t stream,
+                                             const char *file_name) {
+  char path[256];
+  snprintf(path, sizeof(path), "/proc/asound/card%d/pcm%d%c/sub%d/%s", card_number,
+           device_number, proc_asound_stream_letter(stream), subdevice_number, file_name);
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    int open_errno = errno; // for the caller, in case debug() changes it
+    debug(2, "can not open \"%s\": %s.", path, strerror(open_errno));
+    errno = open_errno;
+  }
+  return f;
+}
+
+static void proc_asound_read_hw_params(FILE *f, proc_asound_substream *s) {
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char *key, *value;
+    if (strncmp(line, "closed", strlen("closed")) == 0) {
+      s->setup = PROC_ASOUND_SUBSTREAM_CLOSED;
+    } else if (strncmp(line, "no setup", strlen("no setup")) == 0) {
+      s->setup = PROC_ASOUND_SUBSTREAM_NO_SETUP;
+    } else if (proc_asound_split_line(line, &key, &value) == 0) {
+      s->setup = PROC_ASOUND_SUBSTREAM_SETUP;
+      if (strcmp(key, "access") == 0)
+        proc_asound_copy_value(s->access, sizeof(s->access), value);
+      else if (strcmp(key, "format") == 0)
+        proc_asound_copy_value(s->format, sizeof(s->format), value);
+      else if (strcmp(key, "channels") == 0)
+        s->channels = strtoul(value, NULL, 10);
+      else if (strcmp(key, "rate") == 0)
+        s->rate = strtoul(value, NULL, 10); // e.g. "44100 (44100/1)"
+      else if (strcmp(key, "period_size") == 0)
+        s->period_size = strtoul(value, NULL, 10);
+      else if (strcmp(key, "buffer_size") == 0)
+        s->buffer_size = strtoul(value, NULL, 10);
+    }
+  }
+}
+
+static void proc_asound_read_sw_params(FILE *f, proc_asound_substream *s) {
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char *key, *value;
+    if (proc_asound_split_line(line, &key, &value) == 0) {
+      if (strcmp(key, "tstamp_mode") == 0)
+        proc_asound_copy_value(s->tstamp_mode, sizeof(s->tstamp_mode), value);
+      else if (strcmp(key, "avail_min") == 0)
+        s->avail_min = strtoul(value, NULL, 10);
+      else if (strcmp(key, "start_threshold") == 0)
+        s->start_threshold = strtoul(value, NULL, 10);
+      else if (strcmp(key, "stop_threshold") == 0)
+        s->stop_threshold = strtoul(value, NULL, 10);
+      else if (strcmp(key, "boundary") == 0)
+        s->boundary = strtoul(value, NULL, 10);
+    }
+  }
+}
+
+static void proc_asound_read_status(FILE *f, proc_asound_substream *s) {
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char *key, *value;
+    if (proc_asound_split_line(line, &key, &value) == 0) {
+      if (strcmp(key, "state") == 0)
+        proc_asound_copy_value(s->state, sizeof(s->state), value);
+      else if (strcmp(key, "owner_pid") == 0)
+        s->owner_pid = strtol(value, NULL, 10);
+      else if (strcmp(key, "trigger_time") == 0)
+        s->trigger_time = strtod(value, NULL);
+      else if (strcmp(key, "tstamp") == 0)
+        s->tstamp = strtod(value, NULL);
+      else if (strcmp(key, "delay") == 0)
+        s->delay = strtol(value, NULL, 10);
+      else if (strcmp(key, "avail") == 0)
+        s->avail = strtol(value, NULL, 10);
+      else if (strcmp(key, "avail_max") == 0)
+        s->avail_max = strtol(value, NULL, 10);
+      else if (strcmp(key, "hw_ptr") == 0)
+        s->hw_ptr = strtoul(value, NULL, 10);
+      else if (strcmp(key, "appl_ptr") == 0)
+        s->appl_ptr = strtoul(value, NULL, 10);
+    }
+  }
+}
+
+// returns the smallest number n greater than after for which "<prefix>n<suffix>" is an entry of
+// the directory, or -1
+static int proc_asound_next_numbered_entry(const char *directory, const char *prefix,
+                                           const char *suffix, int after) {
+  int result = -1;
+  DIR *dp = opendir(directory);
+  if (dp != NULL) {
+    struct dirent *dirp;
+    size_t prefix_length = strlen(prefix);
+    while ((dirp = readdir(dp)) != NULL) {
+      if ((strncmp(dirp->d_name, prefix, prefix_length) == 0) &&
+          (isdigit((unsigned char)dirp->d_name[prefix_length]))) {
+        char *end;
+        long n = strtol(dirp->d_name + prefix_length, &end, 10);
+        if ((strcmp(end, suffix) == 0) && (n > after) && ((result < 0) || (n < result)))
+          result = n;
+      }
+    }
+    closedir(dp);
+  }
+  return result;
+}
+
+int proc_asound_next_card(int card_number) {
+  return proc_asound_next_numbered_entry("/proc/asound", "card", "", card_number);
+}
+
+int proc_asound_next_pcm_device(int card_number, int device_number, snd_pcm_stream_t stream) {
+  char directory[64];
+  char suffix[2] = {proc_asound_stream_letter(stream), '\0'};
+  snprintf(directory, sizeof(directory), "/proc/asound/card%d", card_number);
+  return proc_asound_next_numbered_entry(directory, "pcm", suffix, device_number);
+}
+
+int proc_asound_card_info_read(int card_number, char *id, size_t id_size, char *name,
+                               size_t name_size) {
+  // lines in /proc/asound/cards look like this:
+  // " 0 [PCH            ]: HDA-Intel - HDA Intel PCH"
+  // followed by a line with the long name.
+  int result = -ENOENT;
+  FILE *f = fopen("/proc/asound/cards", "r");
+  if (f == NULL)
+    return -errno;
+  char line[256];
+  while ((result != 0) && (fgets(line, sizeof(line), f) != NULL)) {
+    char *end;
+    long n = strtol(line, &end, 10);
+    if ((end != line) && (n == card_number) && (strchr(end, '[') != NULL)) {
+      char *id_start = strchr(end, '[') + 1;
+      char *id_end = strchr(id_start, ']');
+      char *separator = strstr(id_start, " - ");
+      if ((id_end != NULL) && (separator != NULL)) {
+        *id_end = '\0';
+        id_start[strcspn(id_start, " ")] = '\0'; // the id is padded with spaces
+        proc_asound_copy_value(id, id_size, id_start);
+        separator = separator + strlen(" - ");
+        separator[strcspn(separator, "\n")] = '\0';
+        proc_asound_copy_value(name, name_size, separator);
+        result = 0;
+      }
+    }
+  }
+  fclose(f);
+  return result;
+}
+
+int proc_asound_pcm_info_read(int card_number, int device_number, int subdevice_number,
+                              snd_pcm_stream_t stream, proc_asound_pcm_info *info) {
+  memset(info, 0, sizeof(proc_asound_pcm_info));
+  FILE *f = proc_asound_open_substream_file(card_number, device_number, subdevice_number, stream,
+                                            "info");
+  if (f == NULL)
+    return -errno;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char *key, *value;
+    if (proc_asound_split_line(line, &key, &value) == 0) {
+      if (strcmp(key, "id") == 0)
+        proc_asound_copy_value(info->id, sizeof(info->id), value);
+      else if (strcmp(key, "name") == 0)
+        proc_asound_copy_value(info->name, sizeof(info->name), value);
+      else if (strcmp(key, "subname") == 0)
+        proc_asound_copy_value(info->subname, sizeof(info->subname), value);
+      else if (strcmp(key, "subdevices_count") == 0)
+        info->subdevices_count = strtol(value, NULL, 10);
+      else if (strcmp(key, "subdevices_avail") == 0)
+        info->subdevices_avail = strtol(value, NULL, 10);
+    }
+  }
+  fclose(f);
+  return 0;
+}
+
+static void proc_asound_add_rate(proc_asound_capability *c, unsigned int rate) {
+  if ((rate != 0) && (c->rate_count < (int)(sizeof(c->rates) / sizeof(c->rates[0]))))
+    c->rates[c->rate_count++] = rate;
+}
+
+// Parse a USB Audio stream descriptor file, e.g. /proc/asound/card1/stream0.
+// Each altsetting in the Playback (or Capture) section looks like this:
+//   Interface 1
+//     Altset 1
+//     Format: S16_LE S24_3LE
+//     Channels: 2
+//     Endpoint: 0x01 (1 OUT) (ASYNC)
+//     Rates: 44100, 48000, 96000         (or "Rates: 8000 - 96000 (continuous)")
+static int proc_asound_parse_usb_stream(FILE *f, snd_pcm_stream_t stream,
+                                        proc_asound_prediction *prediction) {
+  const char *wanted_section = stream == SND_PCM_STREAM_PLAYBACK ? "Playback:" : "Capture:";
+  const char *other_section = stream == SND_PCM_STREAM_PLAYBACK ? "Capture:" : "Playback:";
+  int in_section = 0;
+  proc_asound_capability *c = NULL;
+  char line[512];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, wanted_section, strlen(wanted_section)) == 0) {
+      in_section = 1;
+      continue;
+    } else if (strncmp(line, other_section, strlen(other_section)) == 0) {
+      in_section = 0;
+      c = NULL;
+      continue;
+    }
+    if (in_section == 0)
+      continue;
+    char *p = line;
+    while (isspace((unsigned char)*p))
+      p++;
+    // "Altset = 1" lines in the Status section describe the current setting -- skip them
+    if ((strncmp(p, "Altset", strlen("Altset")) == 0) && (strchr(p, '=') == NULL)) {
+      if (prediction->count < (int)(sizeof(prediction->entries) / sizeof(prediction->entries[0]))) {
+        c = &prediction->entries[prediction->count++];
+        memset(c, 0, sizeof(proc_asound_capability));
+      } else {
+        c = NULL;
+      }
+      continue;
+    }
+    char *key, *value;
+    if ((c == NULL) || (proc_asound_split_line(p, &key, &value) != 0))
+      continue;
+    if (strcmp(key, "Format") == 0) {
+      char *saveptr = NULL;
+      char *token;
+      for (token = strtok_r(value, " ", &saveptr); token != NULL;
+           token = strtok_r(NULL, " ", &saveptr)) {
+        snd_pcm_format_t format = snd_pcm_format_value(token);
+        if ((format >= 0) && (format < 64))
+          c->formats |= (uint64_t)1 << format;
+      }
+    } else if (strcmp(key, "Channels") == 0) {
+      c->channels_min = c->channels_max = strtoul(value, NULL, 10);
+    } else if (strcmp(key, "Rates") == 0) {
+      if (strstr(value, "continuous") != NULL) {
+        char *end;
+        c->continuous = 1;
+        c->rate_min = strtoul(value, &end, 10);
+        end = strchr(end, '-');
+        if (end != NULL)
+          c->rate_max = strtoul(end + 1, NULL, 10);
+      } else {
+        char *saveptr = NULL;
+        char *token;
+        for (token = strtok_r(value, ", ", &saveptr); token != NULL;
+             token = strtok_r(NULL, ", ", &saveptr))
+          proc_asound_add_rate(c, strtoul(token, NULL, 10));
+      }
+    }
+  }
+  return prediction->count > 0 ? 0 : -ENOENT;
+}
+
+// Parse an HDA codec file, e.g. /proc/asound/card0/codec#0, collecting the PCM capabilities of
+// the Default PCM and of every Audio Output node:
+//   Node 0x02 [Audio Output] wcaps 0x41d: Stereo Amp-Out
+//     ...
+//     PCM:
+//       rates [0x560]: 44100 48000 96000 192000
+//       bits [0xe]: 16 20 24
+// The codec doesn't say which nodes serve which PCM device -- an HDMI device is listed alongside
+// the analog ones -- nor how many channels each accepts, so the capabilities are only a superset
+// of what any one device on the card accepts. That's fine for screening out what can't work, but
+// the prediction is marked as card-wide, as it can't say what a particular device will accept.
+// The HDA driver presents 20, 24 and 32 bit samples as S32_LE.
+static int proc_asound_parse_hda_codec(FILE *f, proc_asound_prediction *prediction) {
+  int in_output = 0;
+  proc_asound_capability *c = NULL;
+  char line[512];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, "Node ", strlen("Node ")) == 0) {
+      in_output = strstr(line, "[Audio Output]") != NULL;
+      c = NULL;
+      continue;
+    } else if (strncmp(line, "Default PCM:", strlen("Default PCM:")) == 0) {
+      in_output = 1;
+      c = NULL;
+      continue;
+    }
+    if (in_output == 0)
+      continue;
+    char *p = line;
+    while (isspace((unsigned char)*p))
+      p++;
+    char *values = strstr(p, "]:");
+    if (values == NULL)
+      continue;
+    values = values + strlen("]:");
+    if (strncmp(p, "rates [", strlen("rates [")) == 0) {
+      if (prediction->count < (int)(sizeof(prediction->entries) / sizeof(prediction->entries[0]))) {
+        c = &prediction->entries[prediction->count++];
+        memset(c, 0, sizeof(proc_asound_capability));
+        c->channels_min = 1;
+        c->channels_max = 8; // channels can't be predicted from the codec information
+        char *saveptr = NULL;
+        char *token;
+        for (token = strtok_r(values, " \n", &saveptr); token != NULL;
+             token = strtok_r(NULL, " \n", &saveptr))
+          proc_asound_add_rate(c, strtoul(token, NULL, 10));
+      }
+    } else if ((strncmp(p, "bits [", strlen("bits [")) == 0) && (c != NULL)) {
+      char *saveptr = NULL;
+      char *token;
+      for (token = strtok_r(values, " \n", &saveptr); token != NULL;
+           token = strtok_r(NULL, " \n", &saveptr)) {
+        unsigned long bits = strtoul(token, NULL, 10);
+        if (bits == 8)
+          c->formats |= (uint64_t)1 << SND_PCM_FORMAT_U8;
+        else if (bits == 16)
+          c->formats |= (uint64_t)1 << SND_PCM_FORMAT_S16_LE;
+        else if (bits > 16)
+          c->formats |= (uint64_t)1 << SND_PCM_FORMAT_S32_LE;
+      }
+    }
+  }
+  return prediction->count > 0 ? 0 : -ENOENT;
+}
+
+int proc_asound_predict(int card_number, int device_number, snd_pcm_stream_t stream,
+                        proc_asound_prediction *prediction) {
+  memset(prediction, 0, sizeof(proc_asound_prediction));
+  int result = -ENOENT;
+  // USB Audio has a stream descriptor file per PCM device
+  snprintf(prediction->source, sizeof(prediction->source), "/proc/asound/card%d/stream%d",
+           card_number, device_number);
+  FILE *f = fopen(prediction->source, "r");
+  if (f != NULL) {
+    result = proc_asound_parse_usb_stream(f, stream, prediction);
+    fclose(f);
+  } else if (stream == SND_PCM_STREAM_PLAYBACK) {
+    // HDA has a file per codec instead
+    int codec;
+    for (codec = 0; codec < 8; codec++) {
+      char path[64];
+      snprintf(path, sizeof(path), "/proc/asound/card%d/codec#%d", card_number, codec);
+      f = fopen(path, "r");
+      if (f != NULL) {
+        if ((proc_asound_parse_hda_codec(f, prediction) == 0) && (result != 0)) {
+          snprintf(prediction->source, sizeof(prediction->source), "%s", path);
+          prediction->card_wide = 1;
+          result = 0;
+        }
+        fclose(f);
+      }
+    }
+  }
+  // only useful if it predicts some formats and rates
+  int i;
+  int usable_entries = 0;
+  for (i = 0; i < prediction->count; i++) {
+    proc_asound_capability *c = &prediction->entries[i];
+    if ((c->formats != 0) && ((c->rate_count != 0) || (c->continuous != 0)))
+      usable_entries++;
+  }
+  if (usable_entries == 0)
+    result = -ENOENT;
+  if (result == 0)
+    debug(2, "capabilities of card %d, device %d predicted from \"%s\".", card_number,
+          device_number, prediction->source);
+  return result;
+}
+
+int proc_asound_prediction_allows(const proc_asound_prediction *prediction,
+                                  snd_pcm_format_t format, unsigned int channels,
+                                  unsigned int rate) {
+  if ((format < 0) || (format >= 64))
+    return 0;
+  int i;
+  for (i = 0; i < prediction->count; i++) {
+    const proc_asound_capability *c = &prediction->entries[i];
+    if (((c->formats & ((uint64_t)1 << format)) == 0) || (channels < c->channels_min) ||
+        (channels > c->channels_max))
+      continue;
+    if (c->continuous != 0) {
+      if ((rate >= c->rate_min) && (rate <= c->rate_max))
+        return 1;
+    } else {
+      int r;
+      for (r = 0; r < c->rate_count; r++)
+        if (c->rates[r] == rate)
+          return 1;
+    }
+  }
+  return 0;
+}
+
+int proc_asound_substream_read(int card_number, int device_number, int subdevice_number,
+                               snd_pcm_stream_t stream, proc_asound_substream *s) {
+  memset(s, 0, sizeof(proc_asound_substream));
+  FILE *f = proc_asound_open_substream_file(card_number, device_number, subdevice_number, stream,
+                                            "hw_params");
+  if (f == NULL)
+    return -errno;
+  proc_asound_read_hw_params(f, s);
+  fclose(f);
+  if (s->setup == PROC_ASOUND_SUBSTREAM_CLOSED)
+    return 0; // nothing more to be learned
+  f = proc_asound_open_substream_file(card_number, device_number, subdevice_number, stream,
+                                      "sw_params");
+  if (f != NULL) {
+    proc_asound_read_sw_params(f, s);
+    fclose(f);
+  }
+  f = proc_asound_open_substream_file(card_number, device_number, subdevice_number, stream,
+                                      "status");
+  if (f != NULL) {
+    proc_asound_read_status(f, s);
+    fclose(f);
+  }
+  return 0;
+}
+
+int proc_asound_subdevice_count(int card_number, int device_number, snd_pcm_stream_t stream) {
+  char path[256];
+  snprintf(path, sizeof(path), "/proc/asound/card%d/pcm%d%c", card_number, device_number,
+           proc_asound_stream_letter(stream));
+  DIR *dp = opendir(path);
+  if (dp == NULL)
+    return -errno;
+  int count = 0;
+  struct dirent *dirp;
+  while ((dirp = readdir(dp)) != NULL) {
+    if ((strncmp(dirp->d_name, "sub", 3) == 0) && (isdigit((unsigned char)dirp->d_name[3])))
+      count++;
+  }
+  closedir(dp);
+  return count;
+}
+
+pid_t proc_asound_find_pid_using(int card_number, int device_number, snd_pcm_stream_t stream) {
+  pid_t result = 0;
+  char node[64];
+  snprintf(node, sizeof(node), "/dev/snd/pcmC%dD%d%c", card_number, device_number,
+           proc_asound_stream_letter(stream));
+  DIR *proc_dir = opendir("/proc");
+  if (proc_dir == NULL)
+    return 0;
+  pid_t self = getpid();
+  struct dirent *proc_entry;
+  while ((result == 0) && ((proc_entry = readdir(proc_dir)) != NULL)) {
+    char *end;
+    long pid = strtol(proc_entry->d_name, &end, 10);
+    if ((*end != '\0') || (pid <= 0) || (pid == self))
+      continue;
+    char fd_dir_path[64];
+    snprintf(fd_dir_path, sizeof(fd_dir_path), "/proc/%ld/fd", pid);
+    DIR *fd_dir = opendir(fd_dir_path); // fails without permission -- that's okay
+    if (fd_dir != NULL) {
+      struct dirent *fd_entry;
+      while ((result == 0) && ((fd_entry = readdir(fd_dir)) != NULL)) {
+        char target[128];
+        ssize_t target_length =
+            readlinkat(dirfd(fd_dir), fd_entry->d_name, target, sizeof(target) - 1);
+        if (target_length > 0) {
+          target[target_length] = '\0';
+          if (strcmp(target, node) == 0)
+            result = pid;
+        }
+      }
+      closedir(fd_dir);
+    }
+  }
+  closedir(proc_dir);
+  if (result == 0)
+    debug(2, "no process found using \"%s\".", node);
+  return result;
+}
+
+int proc_asound_process_name(pid_t pid, char *name, size_t name_size) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return -errno;
+  int result = -ENOENT;
+  if (fgets(name, name_size, f) != NULL) {
+    name[strcspn(name, "\n")] = '\0';
+    result = 0;
+  }
+  fclose(f);
+  return result;
+}
@@ -0,0 +1,128 @@
+/*
+ * This file is part of the sps-alsa-explore distribution
+ * (https://github.com/mikebrady/sps-alsa-explore). Copyright (c) 2021-2024 Mike Brady.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Commercial licensing is also available.
+ */
+
+#ifndef _PROCFS_H
+#define _PROCFS_H
+
+// read-only access to the information about ALSA cards, PCM devices and their substreams
+// in /proc/asound, so that devices can be examined without being opened.
+
+#include <alsa/asoundlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum {
+  PROC_ASOUND_SUBSTREAM_CLOSED = 0,
+  PROC_ASOUND_SUBSTREAM_NO_SETUP, // open, but hardware parameters not yet set
+  PROC_ASOUND_SUBSTREAM_SETUP,
+} proc_asound_substream_setup;
+
+typedef struct {
+  proc_asound_substream_setup setup;
+  // from hw_params
+  char access[32];
+  char format[32];
+  unsigned int channels;
+  unsigned int rate;
+  unsigned long period_size;
+  unsigned long buffer_size;
+  // from sw_params
+  char tstamp_mode[32];
+  unsigned long avail_min;
+  unsigned long start_threshold;
+  unsigned long stop_threshold;
+  unsigned long boundary;
+  // from status
+  char state[32];
+  pid_t owner_pid; // zero if the kernel doesn't report it
+  double trigger_time;
+  double tstamp;
+  long delay;
+  long avail;
+  long avail_max;
+  unsigned long hw_ptr;
+  unsigned long appl_ptr;
+} proc_asound_substream;
+
+// from /proc/asound/cardN/pcmDp/subS/info
+typedef struct {
+  char id[64];
+  char name[80];
+  char subname[80];
+  int subdevices_count;
+  int subdevices_avail;
+} proc_asound_pcm_info;
+
+// Capabilities of a stream, predicted from the stream descriptors or codec information that
+// some drivers (e.g. USB Audio and HDA) publish in /proc/asound. Each entry describes one
+// combination of formats, channels and rates that should be accepted, e.g. a USB altsetting.
+typedef struct {
+  uint64_t formats; // bit (1 << snd_pcm_format_t) set for each format accepted
+  unsigned int channels_min;
+  unsigned int channels_max;
+  int continuous; // if nonzero, any rate from rate_min to rate_max, otherwise those in rates[]
+  unsigned int rate_min;
+  unsigned int rate_max;
+  unsigned int rates[32];
+  int rate_count;
+} proc_asound_capability;
+
+typedef struct {
+  char source[64]; // the file the prediction came from, e.g. "/proc/asound/card1/stream0"
+  int card_wide; // if nonzero, what some device on the card accepts, not necessarily this one
+  int count;
+  proc_asound_capability entries[32];
+} proc_asound_prediction;
+
+// step through the cards and the PCM devices of a card listed in /proc/asound,
+// in the manner of snd_card_next and snd_ctl_pcm_next_device. -1 is returned when none remain.
+int proc_asound_next_card(int card_number);
+int proc_asound_next_pcm_device(int card_number, int device_number, snd_pcm_stream_t stream);
+
+// get the card's id (e.g. "PCH") and name (e.g. "HDA Intel PCH"); returns 0 on success
+int proc_asound_card_info_read(int card_number, char *id, size_t id_size, char *name,
+                               size_t name_size);
+
+int proc_asound_pcm_info_read(int card_number, int device_number, int subdevice_number,
+                              snd_pcm_stream_t stream, proc_asound_pcm_info *info);
+
+// returns 0 if a prediction could be made, -ENOENT if the driver doesn't publish enough
+int proc_asound_predict(int card_number, int device_number, snd_pcm_stream_t stream,
+                        proc_asound_prediction *prediction);
+
+// returns nonzero if any entry of the prediction accepts the format, channels and rate
+int proc_asound_prediction_allows(const proc_asound_prediction *prediction,
+                                  snd_pcm_format_t format, unsigned int channels,
+                                  unsigned int rate);
+
+// returns 0 if the substream's files could be read, -errno otherwise
+int proc_asound_substream_read(int card_number, int device_number, int subdevice_number,
+                               snd_pcm_stream_t stream, proc_asound_substream *s);
+
+// returns the number of subdevices listed for the device, or -errno
+int proc_asound_subdevice_count(int card_number, int device_number, snd_pcm_stream_t stream);
+
+// look through /proc/*/fd for a process holding the PCM device node open.
+// returns its pid, or 0 if none could be found (e.g. for lack of permission)
+pid_t proc_asound_find_pid_using(int card_number, int device_number, snd_pcm_stream_t stream);
+
+// copy the command name of process pid into name; returns 0 on success
+int proc_asound_process_name(pid_t pid, char *name, size_t name_size);
+
+#endif /* _PROCFS_H */
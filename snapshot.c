@@ -0,0 +1,325 @@
+/*
+ * This file is part of the sps-alsa-explore distribution
+ * (https://github.com/mikebrady/sps-alsa-explore). Copyright (c) 2021-2024 Mike Brady.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Commercial licensing is also available.
+ */
+
+
+#include "snapshot.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SNAPSHOT_HEADER "# sps-alsa-explore snapshot, version %d"
+
+typedef struct {
+  char **lines;
+  int count;
+  int capacity;
+} snapshot_lines;
+
+static snapshot_lines snapshot_being_made;
+
+static void snapshot_append(snapshot_lines *s, char *line) {
+  if (s->count == s->capacity) {
+    int capacity = s->capacity == 0 ? 256 : s->capacity * 2;
+    char **lines = realloc(s->lines, capacity * sizeof(char *));
+    if (lines == NULL)
+      die("can not allocate memory for a snapshot.");
+    s->lines = lines;
+    s->capacity = capacity;
+  }
+  s->lines[s->count++] = line;
+}
+
+static void snapshot_free(snapshot_lines *s) {
+  int i;
+  for (i = 0; i < s->count; i++)
+    free(s->lines[i]);
+  free(s->lines);
+  memset(s, 0, sizeof(snapshot_lines));
+}
+
+static int snapshot_compare_lines(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void snapshot_sort(snapshot_lines *s) {
+  int i;
+  for (i = 1; (i < s->count) && (strcmp(s->lines[i - 1], s->lines[i]) <= 0); i++)
+    ;
+  if (i < s->count)
+    qsort(s->lines, s->count, sizeof(char *), snapshot_compare_lines);
+}
+
+static void snapshot_clean_field(char *field) {
+  for (; *field != '\0'; field++)
+    if ((*field == '\t') || (*field == '\n') || (*field == '\r'))
+      *field = ' ';
+}
+
+void snapshot_add(const char *device, const char *key, const char *subkey, const char *format,
+                  ...) {
+  char fields[4][512];
+  snprintf(fields[0], sizeof(fields[0]), "%s", device);
+  snprintf(fields[1], sizeof(fields[1]), "%s", key);
+  snprintf(fields[2], sizeof(fields[2]), "%s", subkey);
+  va_list args;
+  va_start(args, format);
+  vsnprintf(fields[3], sizeof(fields[3]), format, args);
+  va_end(args);
+  int i;
+  for (i = 0; i < 4; i++)
+    snapshot_clean_field(fields[i]);
+  size_t size = strlen(fields[0]) + strlen(fields[1]) + strlen(fields[2]) + strlen(fields[3]) + 4;
+  char *line = malloc(size);
+  if (line == NULL)
+    die("can not allocate memory for a snapshot.");
+  snprintf(line, size, "%s\t%s\t%s\t%s", fields[0], fields[1], fields[2], fields[3]);
+  snapshot_append(&snapshot_being_made, line);
+}
+
+int snapshot_write(const char *path) {
+  int result = 0;
+  snapshot_sort(&snapshot_being_made);
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    warn("can not write the snapshot \"%s\": %s.", path, strerror(errno));
+    result = -1;
+  } else {
+    fprintf(f, SNAPSHOT_HEADER "\n", SNAPSHOT_VERSION);
+    int i;
+    for (i = 0; i < snapshot_being_made.count; i++)
+      fprintf(f, "%s\n", snapshot_being_made.lines[i]);
+    if (fclose(f) != 0) {
+      warn("error writing the snapshot \"%s\": %s.", path, strerror(errno));
+      result = -1;
+    }
+  }
+  snapshot_free(&snapshot_being_made);
+  return result;
+}
+
+static int snapshot_read(const char *path, snapshot_lines *s) {
+  memset(s, 0, sizeof(snapshot_lines));
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    warn("can not read the snapshot \"%s\": %s.", path, strerror(errno));
+    return -1;
+  }
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t length;
+  int version = 0;
+  if ((getline(&line, &size, f) < 0) || (sscanf(line, SNAPSHOT_HEADER, &version) != 1) ||
+      (version != SNAPSHOT_VERSION)) {
+    if (version != 0)
+      warn("\"%s\" is a version %d snapshot, but only version %d snapshots can be read.", path,
+           version, SNAPSHOT_VERSION);
+    else
+      warn("\"%s\" is not a snapshot.", path);
+    free(line);
+    fclose(f);
+    return -1;
+  }
+  while ((length = getline(&line, &size, f)) >= 0) {
+    while ((length > 0) && ((line[length - 1] == '\n') || (line[length - 1] == '\r')))
+      line[--length] = '\0';
+    if ((length != 0) && (line[0] != '#')) {
+      char *copy = strdup(line);
+      if (copy == NULL)
+        die("can not allocate memory for a snapshot.");
+      snapshot_append(s, copy);
+    }
+  }
+  free(line);
+  fclose(f);
+  snapshot_sort(s); // they should be sorted already, unless edited
+  return 0;
+}
+
+// Compare the device, key and subkey of two lines, in an order consistent with sorting whole lines.
+static int snapshot_compare_identities(const char *a, const char *b) {
+  int tabs = 0;
+  while ((*a == *b) && (*a != '\0')) {
+    if ((*a == '\t') && (++tabs == 3))
+      return 0;
+    a++;
+    b++;
+  }
+  if (((*a == '\0') || (*a == '\t')) && ((*b == '\0') || (*b == '\t')) && (tabs == 2))
+    return 0; // both lines lack a value
+  return (unsigned char)*a - (unsigned char)*b;
+}
+
+// copy the nth tab-separated field of a line
+static void snapshot_field(const char *line, int n, char *field, size_t size) {
+  for (; (n > 0) && (line != NULL); n--) {
+    line = strchr(line, '\t');
+    if (line != NULL)
+      line++;
+  }
+  if (line == NULL)
+    line = "";
+  size_t length = strcspn(line, "\t");
+  if (length >= size)
+    length = size - 1;
+  memcpy(field, line, length);
+  field[length] = '\0';
+}
+
+static int snapshot_same_device(const char *a, const char *b) {
+  size_t length = strcspn(a, "\t");
+  return (strncmp(a, b, length) == 0) && ((b[length] == '\t') || (b[length] == '\0'));
+}
+
+// Print a difference, under a heading for its device.
+static void snapshot_report(const char *line, const char *what, const char *value_a,
+                            const char *value_b, char *last_device, size_t last_device_size) {
+  char device[512], key[512], subkey[512];
+  snapshot_field(line, 0, device, sizeof(device));
+  snapshot_field(line, 1, key, sizeof(key));
+  snapshot_field(line, 2, subkey, sizeof(subkey));
+  if (strcmp(device, last_device) != 0) {
+    if (strcmp(device, "-") == 0)
+      inform("> Snapshot:");
+    else
+      inform("> Device Full Name:    \"%s\"", device);
+    snprintf(last_device, last_device_size, "%s", device);
+  }
+  char description[1100];
+  if (strcmp(subkey, "-") == 0)
+    snprintf(description, sizeof(description), "%s", key);
+  else
+    snprintf(description, sizeof(description), "%s %s", key, subkey);
+  if (value_b == NULL)
+    inform("  %s %s: \"%s\".", what, description, value_a);
+  else
+    inform("  %s %s: \"%s\" -> \"%s\".", what, description, value_a, value_b);
+}
+
+// Make a list of the devices in a snapshot, in order, with the index of each line's device.
+static int snapshot_devices(const snapshot_lines *s, const char ***devices, int **device_of_line) {
+  *devices = malloc((s->count + 1) * sizeof(char *));
+  *device_of_line = malloc((s->count + 1) * sizeof(int));
+  if ((*devices == NULL) || (*device_of_line == NULL))
+    die("can not allocate memory to compare snapshots.");
+  int count = 0, i;
+  for (i = 0; i < s->count; i++) {
+    if ((count == 0) || (snapshot_same_device((*devices)[count - 1], s->lines[i]) == 0))
+      (*devices)[count++] = s->lines[i];
+    (*device_of_line)[i] = count - 1;
+  }
+  return count;
+}
+
+int snapshot_diff(const char *path_a, const char *path_b) {
+  snapshot_lines a, b;
+  if (snapshot_read(path_a, &a) != 0)
+    return -1;
+  if (snapshot_read(path_b, &b) != 0) {
+    snapshot_free(&a);
+    return -1;
+  }
+  const char **devices_a, **devices_b;
+  int *device_of_line_a, *device_of_line_b;
+  int device_count_a = snapshot_devices(&a, &devices_a, &device_of_line_a);
+  int device_count_b = snapshot_devices(&b, &devices_b, &device_of_line_b);
+  // whether each device is in the other snapshot
+  char *in_b = calloc(device_count_a + 1, 1);
+  char *in_a = calloc(device_count_b + 1, 1);
+  if ((in_a == NULL) || (in_b == NULL))
+    die("can not allocate memory to compare snapshots.");
+  int differences = 0;
+  int i = 0, j = 0;
+  while ((i < device_count_a) || (j < device_count_b)) {
+    int cmp;
+    if (i == device_count_a)
+      cmp = 1;
+    else if (j == device_count_b)
+      cmp = -1;
+    else
+      cmp = snapshot_same_device(devices_a[i], devices_b[j])
+                ? 0
+                : strcmp(devices_a[i], devices_b[j]);
+    if (cmp == 0) {
+      in_b[i++] = 1;
+      in_a[j++] = 1;
+    } else {
+      char device[512];
+      snapshot_field(cmp < 0 ? devices_a[i] : devices_b[j], 0, device, sizeof(device));
+      inform("> Device Full Name:    \"%s\" %s.", device, cmp < 0 ? "removed" : "added");
+      differences++;
+      if (cmp < 0)
+        i++;
+      else
+        j++;
+    }
+  }
+
+  // then the facts about the devices in both
+  char last_device[512] = "";
+  char value_a[512], value_b[512];
+  i = 0;
+  j = 0;
+  while ((i < a.count) || (j < b.count)) {
+    int cmp;
+    if (i == a.count)
+      cmp = 1;
+    else if (j == b.count)
+      cmp = -1;
+    else
+      cmp = snapshot_compare_identities(a.lines[i], b.lines[j]);
+    if (cmp < 0) {
+      if (in_b[device_of_line_a[i]]) {
+        snapshot_field(a.lines[i], 3, value_a, sizeof(value_a));
+        snapshot_report(a.lines[i], "Lost", value_a, NULL, last_device, sizeof(last_device));
+        differences++;
+      }
+      i++;
+    } else if (cmp > 0) {
+      if (in_a[device_of_line_b[j]]) {
+        snapshot_field(b.lines[j], 3, value_b, sizeof(value_b));
+        snapshot_report(b.lines[j], "Gained", value_b, NULL, last_device, sizeof(last_device));
+        differences++;
+      }
+      j++;
+    } else {
+      snapshot_field(a.lines[i], 3, value_a, sizeof(value_a));
+      snapshot_field(b.lines[j], 3, value_b, sizeof(value_b));
+      if (strcmp(value_a, value_b) != 0) {
+        snapshot_report(a.lines[i], "Changed", value_a, value_b, last_device,
+                        sizeof(last_device));
+        differences++;
+      }
+      i++;
+      j++;
+    }
+  }
+  if (differences == 0)
+    inform("No differences found between \"%s\" and \"%s\".", path_a, path_b);
+  free(in_a);
+  free(in_b);
+  free(devices_a);
+  free(devices_b);
+  free(device_of_line_a);
+  free(device_of_line_b);
+  snapshot_free(&a);
+  snapshot_free(&b);
+  return differences != 0 ? 1 : 0;
+}
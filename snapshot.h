@@ -0,0 +1,42 @@
+/*
+ * This file is part of the sps-alsa-explore distribution
+ * (https://github.com/mikebrady/sps-alsa-explore). Copyright (c) 2021-2024 Mike Brady.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Commercial licensing is also available.
+ */
+
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+// A snapshot is a text file recording what was found about each device, one fact per line, so that
+// snapshots taken on different machines, or before and after a kernel upgrade, can be compared.
+// Each line has four tab-separated fields: the device, a key, a subkey ("-" if none) and a value.
+// The lines are sorted, so two snapshots can be compared in a single pass.
+
+#define SNAPSHOT_VERSION 1
+
+// Add a fact to the snapshot being made. Tabs and newlines in the fields are replaced by spaces.
+void snapshot_add(const char *device, const char *key, const char *subkey, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+// Write the facts added to a snapshot file and forget them. Returns 0 on success.
+int snapshot_write(const char *path);
+
+// Report the differences between two snapshot files.
+// Returns 0 if there are none, 1 if there are, or -1 if either can't be read.
+int snapshot_diff(const char *path_a, const char *path_b);
+
+#endif /* _SNAPSHOT_H */
@@ -24,6 +24,10 @@
 
 #include "sps-alsa-explore.h"
 #include "gitversion.h"
+#include "measure.h"
+#include "monitor.h"
+#include "procfs.h"
+#include "snapshot.h"
 #include <alsa/asoundlib.h>
 #include <assert.h>
 #include <ctype.h>
@@ -41,6 +45,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/utsname.h>
+#include <time.h>
 
 #define LEVEL_BASIC (1 << 0)
 #define LEVEL_INACTIVE (1 << 1)
@@ -49,86 +55,218 @@
 char card[64];
 int extended_output = 0;
 int check_subdevices = 0;
+int no_open = 0; // if set, report purely from /proc/asound, never opening a device
 
-static int selems_if_has_db_playback(int include_mixers_with_capture, char *firstPrompt,
-                                     char *subsequentPrompt) {
-  int result = 0;
-  int firstPromptUsed = 0;
+// if set, the predicted capabilities of the device being checked
+proc_asound_prediction *prescreen = NULL;
+int pcm_open_count = 0;
+int prescreen_skip_count = 0;
+int mixer_open_count = 0;
+
+#define MAX_MIXERS 32
+// the part of a mixer's range, below its maximum, in which its steps matter, in hundredths of a dB
+#define MIXER_USABLE_RANGE 6000
+// a raw range larger than this isn't examined step by step
+#define MIXER_MAX_RAW_STEPS 65536
+
+typedef struct {
+  char name[64];
+  unsigned int index;
+  int has_capture_elements;
+  long min_db; // in hundredths of a dB, above the mute setting if there is one
+  long max_db;
+  long raw_min;
+  long raw_max;
+  int steps;            // distinct dB values over the raw range
+  long largest_step_db; // the largest step in the usable part of the range
+  int monotonic;
+  int lowest_is_mute; // e.g. on the Raspberry Pi
+  int software;       // a user-defined control, e.g. from the softvol plugin
+  int score;          // out of 100
+  int order;          // in which the driver lists it
+} mixer_analysis;
+
+// the mixers of the card examined last, loaded once for all its devices
+static struct {
+  char card[64];
+  int count; // negative if the mixers could not be loaded
+  mixer_analysis mixers[MAX_MIXERS];
+} card_mixers;
+
+// a volume control is taken to be software if its control element was added by a user, e.g. by
+// the softvol plugin, rather than by the driver
+static int mixer_is_software(snd_ctl_t *ctl, snd_mixer_elem_t *elem) {
+  const char *suffixes[] = {" Playback Volume", " Volume"};
+  snd_ctl_elem_id_t *id;
+  snd_ctl_elem_info_t *info;
+  snd_ctl_elem_id_alloca(&id);
+  snd_ctl_elem_info_alloca(&info);
+  size_t i;
+  for (i = 0; (ctl != NULL) && (i < sizeof(suffixes) / sizeof(suffixes[0])); i++) {
+    char name[128];
+    snprintf(name, sizeof(name), "%s%s", snd_mixer_selem_get_name(elem), suffixes[i]);
+    snd_ctl_elem_id_set_interface(id, SND_CTL_ELEM_IFACE_MIXER);
+    snd_ctl_elem_id_set_name(id, name);
+    snd_ctl_elem_id_set_index(id, snd_mixer_selem_get_index(elem));
+    snd_ctl_elem_info_set_id(info, id);
+    if (snd_ctl_elem_info(ctl, info) == 0)
+      return snd_ctl_elem_info_is_user(info);
+  }
+  return 0;
+}
+
+// Step through the mixer's raw range, looking at the dB value of every setting.
+static void analyse_mixer_steps(snd_mixer_elem_t *elem, mixer_analysis *m) {
+  m->monotonic = 1;
+  if ((snd_mixer_selem_get_playback_volume_range(elem, &m->raw_min, &m->raw_max) < 0) ||
+      (m->raw_max - m->raw_min > MIXER_MAX_RAW_STEPS)) {
+    debug(1, "Can't examine the steps of mixer \"%s\".", m->name);
+    return;
+  }
+  long value, db, previous_db = 0;
+  int previous_valid = 0;
+  for (value = m->raw_min; value <= m->raw_max; value++) {
+    if ((snd_mixer_selem_ask_playback_vol_dB(elem, value, &db) != 0) ||
+        (db == SND_CTL_TLV_DB_GAIN_MUTE))
+      continue;
+    if (previous_valid == 0) {
+      m->steps = 1;
+    } else if (db != previous_db) {
+      m->steps++;
+      if (db < previous_db)
+        m->monotonic = 0;
+      else if ((m->max_db - db < MIXER_USABLE_RANGE) && (db - previous_db > m->largest_step_db))
+        m->largest_step_db = db - previous_db;
+    }
+    previous_db = db;
+    previous_valid = 1;
+  }
+}
+
+// Score a mixer out of 100, favouring a wide range in fine, even steps in a hardware control
+// that isn't shared with capture.
+static int score_mixer(const mixer_analysis *m) {
+  double range = (m->max_db - m->min_db) * 0.01;
+  double score = (range < 60.0 ? range : 60.0) / 60.0 * 40.0;
+  if (m->largest_step_db != 0) {
+    double largest_step = m->largest_step_db * 0.01;
+    score += largest_step < 0.5 ? 30.0 : 30.0 * 0.5 / largest_step;
+  } else if (m->steps > 1) {
+    score += 30.0; // all its steps are below the usable range
+  }
+  if (m->monotonic != 0)
+    score += 10.0;
+  if (m->software == 0)
+    score += 10.0;
+  if (m->has_capture_elements == 0)
+    score += 10.0;
+  return (int)(score + 0.5);
+}
+
+// Playback-only mixers first, then by score, then in the order the driver lists them.
+static int compare_mixer_scores(const void *a, const void *b) {
+  const mixer_analysis *ma = a, *mb = b;
+  if (ma->has_capture_elements != mb->has_capture_elements)
+    return ma->has_capture_elements - mb->has_capture_elements;
+  if (ma->score != mb->score)
+    return mb->score - ma->score;
+  return ma->order - mb->order;
+}
+
+// Forget the mixers analysed, so that load_mixers() analyses them again.
+void forget_mixers(void) { card_mixers.card[0] = '\0'; }
+
+// Load and analyse the decibel-mapped playback mixers of the card, unless they were analysed for
+// the last device. Returns the number of mixers, or a negative error code.
+int load_mixers(void) {
+  if (strcmp(card_mixers.card, card) == 0)
+    return card_mixers.count;
+  snprintf(card_mixers.card, sizeof(card_mixers.card), "%s", card);
+  card_mixers.count = 0;
+  int result;
   snd_mixer_t *handle;
-  snd_mixer_selem_id_t *sid;
   snd_mixer_elem_t *elem;
-  snd_mixer_selem_id_alloca(&sid);
-  long min_db, max_db;
-
+  mixer_open_count++;
   if ((result = snd_mixer_open(&handle, 0)) < 0) {
-    if (firstPrompt != NULL)
-      debug(1, "Mixer %s open error: %s", card, snd_strerror(result));
+    debug(1, "Mixer %s open error: %s", card, snd_strerror(result));
   } else {
     if ((result = snd_mixer_attach(handle, card)) < 0) {
-      if (firstPrompt != NULL)
-        debug(1, "Mixer attach %s error: %s", card, snd_strerror(result));
+      debug(1, "Mixer attach %s error: %s", card, snd_strerror(result));
+    } else if ((result = snd_mixer_selem_register(handle, NULL, NULL)) < 0) {
+      debug(1, "Mixer register error: %s", snd_strerror(result));
+    } else if ((result = snd_mixer_load(handle)) < 0) {
+      debug(1, "Mixer %s load error: %s", card, snd_strerror(result));
     } else {
-      if ((result = snd_mixer_selem_register(handle, NULL, NULL)) < 0) {
-        if (firstPrompt != NULL)
-          debug(1, "Mixer register error: %s", snd_strerror(result));
-      } else {
-        if ((result = snd_mixer_load(handle)) < 0) {
-          if (firstPrompt != NULL)
-            debug(1, "Mixer %s load error: %s", card, snd_strerror(result));
-        } else {
-          for (elem = snd_mixer_first_elem(handle); elem; elem = snd_mixer_elem_next(elem)) {
-            if (snd_mixer_selem_is_active(elem)) {
-              int has_capture_elements = snd_mixer_selem_has_common_volume(elem) ||
-                                         snd_mixer_selem_has_capture_volume(elem) ||
-                                         snd_mixer_selem_has_common_switch(elem) ||
-                                         snd_mixer_selem_has_capture_switch(elem);
-
-              if (((include_mixers_with_capture == 1) && has_capture_elements) ||
-                  ((include_mixers_with_capture == 0) && (!has_capture_elements))) {
-                if (snd_mixer_selem_get_playback_dB_range(elem, &min_db, &max_db) == 0) {
-                  if (min_db == SND_CTL_TLV_DB_GAIN_MUTE) {
-                    // For instance, the Raspberry Pi does this
-                    debug(1, "Lowest dB value is a mute");
-                    long minv = 0;
-                    long maxv = 0;
-                    if (snd_mixer_selem_get_playback_volume_range(elem, &minv, &maxv) < 0)
-                      debug(1, "Can't read mixer's [linear] min and max volumes.");
-
-                    if (snd_mixer_selem_ask_playback_vol_dB(elem, minv + 1, &min_db) != 0)
-                      debug(1, "Can't get dB value corresponding to a minimum volume "
-                               "+ 1.");
-                  }
-                  if (firstPrompt != NULL) {
-
-                    if (extended_output == 0)
-                      inform("%s\"%s\",%d%*sRange: %6.2f dB",
-                             (firstPromptUsed != 0) && (subsequentPrompt != NULL) ? subsequentPrompt
-                                                                                  : firstPrompt,
-                             snd_mixer_selem_get_name(elem), snd_mixer_selem_get_index(elem),
-                             20 - strlen(snd_mixer_selem_get_name(elem)), " ",
-                             (max_db - min_db) * 0.01);
-                    else
-                      inform("%s\"%s\",%d%*sRange: %6.2f dB, max: %6.2f dB, min: %6.2f dB",
-                             (firstPromptUsed != 0) && (subsequentPrompt != NULL) ? subsequentPrompt
-                                                                                  : firstPrompt,
-                             snd_mixer_selem_get_name(elem), snd_mixer_selem_get_index(elem),
-                             20 - strlen(snd_mixer_selem_get_name(elem)), " ",
-                             (max_db - min_db) * 0.01, max_db * 0.01, min_db * 0.01);
-                    firstPromptUsed = 1;
-                  }
-                  result++;
-                }
-              }
-            }
-          }
+      snd_ctl_t *ctl = NULL;
+      if (snd_ctl_open(&ctl, card, 0) < 0)
+        ctl = NULL;
+      for (elem = snd_mixer_first_elem(handle); (elem != NULL) && (card_mixers.count < MAX_MIXERS);
+           elem = snd_mixer_elem_next(elem)) {
+        long min_db, max_db;
+        if ((snd_mixer_selem_is_active(elem) == 0) ||
+            (snd_mixer_selem_get_playback_dB_range(elem, &min_db, &max_db) != 0))
+          continue;
+        mixer_analysis *m = &card_mixers.mixers[card_mixers.count];
+        memset(m, 0, sizeof(mixer_analysis));
+        m->min_db = min_db;
+        m->max_db = max_db;
+        snprintf(m->name, sizeof(m->name), "%s", snd_mixer_selem_get_name(elem));
+        m->index = snd_mixer_selem_get_index(elem);
+        m->has_capture_elements = snd_mixer_selem_has_common_volume(elem) ||
+                                  snd_mixer_selem_has_capture_volume(elem) ||
+                                  snd_mixer_selem_has_common_switch(elem) ||
+                                  snd_mixer_selem_has_capture_switch(elem);
+        if (m->min_db == SND_CTL_TLV_DB_GAIN_MUTE) {
+          // For instance, the Raspberry Pi does this
+          debug(1, "Lowest dB value is a mute");
+          m->lowest_is_mute = 1;
+          long minv = 0;
+          long maxv = 0;
+          if (snd_mixer_selem_get_playback_volume_range(elem, &minv, &maxv) < 0)
+            debug(1, "Can't read mixer's [linear] min and max volumes.");
+          if (snd_mixer_selem_ask_playback_vol_dB(elem, minv + 1, &m->min_db) != 0)
+            debug(1, "Can't get dB value corresponding to a minimum volume + 1.");
         }
+        analyse_mixer_steps(elem, m);
+        m->software = mixer_is_software(ctl, elem);
+        m->score = score_mixer(m);
+        m->order = card_mixers.count;
+        card_mixers.count++;
       }
+      if (ctl != NULL)
+        snd_ctl_close(ctl);
+      qsort(card_mixers.mixers, card_mixers.count, sizeof(mixer_analysis), compare_mixer_scores);
+      result = card_mixers.count;
     }
     snd_mixer_close(handle);
   }
+  if (result < 0)
+    card_mixers.count = result;
   return result;
 }
 
+// List the mixers, best first.
+static void print_mixers(const char *firstPrompt, const char *subsequentPrompt) {
+  int i;
+  for (i = 0; i < card_mixers.count; i++) {
+    const mixer_analysis *m = &card_mixers.mixers[i];
+    const char *prompt = i == 0 ? firstPrompt : subsequentPrompt;
+    if (extended_output == 0) {
+      inform("%s\"%s\",%d%*sRange: %6.2f dB, Score: %3d", prompt, m->name, m->index,
+             (int)(20 - strlen(m->name)), " ", (m->max_db - m->min_db) * 0.01, m->score);
+    } else {
+      inform("%s\"%s\",%d%*sRange: %6.2f dB, max: %6.2f dB, min: %6.2f dB, Score: %3d", prompt,
+             m->name, m->index, (int)(20 - strlen(m->name)), " ", (m->max_db - m->min_db) * 0.01,
+             m->max_db * 0.01, m->min_db * 0.01, m->score);
+      inform("%s  %d steps, largest step %.2f dB%s%s, %s control%s.", subsequentPrompt, m->steps,
+             m->largest_step_db * 0.01, m->monotonic != 0 ? "" : ", not monotonic",
+             m->lowest_is_mute != 0 ? ", lowest setting mutes" : "",
+             m->software != 0 ? "software" : "hardware",
+             m->has_capture_elements != 0 ? ", shared with capture" : "");
+    }
+  }
+}
+
 typedef enum {
   SPS_FORMAT_UNKNOWN = 0,
   SPS_FORMAT_S8,
@@ -148,21 +286,6 @@ typedef enum {
   SPS_FORMAT_INVALID,
 } sps_format_t;
 
-// the negative of these enums is used as an error code
-typedef enum {
-  SPS_EXPLORE_STATUS_OK = 0,
-  SPS_EXPLORE_STATUS_ERROR,
-  SPS_EXPLORE_STATUS_CANT_SET_FORMAT,
-  SPS_EXPLORE_STATUS_CANT_SET_SPEED,
-  SPS_EXPLORE_STATUS_DEVICE_BUSY,
-  SPS_EXPLORE_STATUS_DEVICE_CANT_BE_OPENED,
-  SPS_EXPLORE_STATUS_DEVICE_CANT_SET_HW_PARAMS,
-  SPS_EXPLORE_STATUS_524_ERROR, // seems to be when the HDMI device can't be initialised
-} sps_explore_status;
-
-snd_pcm_t *alsa_handle = NULL;
-snd_pcm_hw_params_t *alsa_params = NULL;
-snd_pcm_sw_params_t *alsa_swparams = NULL;
 int frame_size; // in bytes for interleaved stereo
 
 // This array is a sequence of the output rates to be tried if automatic speed selection is
@@ -181,6 +304,42 @@ unsigned int alternate_speed_output_rates[] = {
     8000, 48000, 96000, 192000, 384000,
 };
 
+// What a check of a device found, so that it needn't be checked again to report on it.
+typedef struct {
+  int status; // as returned by check_alsa_device()
+  uint32_t formats[sizeof(auto_speed_output_rates) / sizeof(int)];
+  int alternates_checked;
+  int alternate_status;
+  uint32_t alternate_formats[sizeof(alternate_speed_output_rates) / sizeof(int)];
+} device_capabilities;
+
+// With -s, the first available subdevice of a device is checked fully. The other subdevices almost
+// always have identical hardware constraints, so if snd_pcm_info reports the same properties for
+// them, a single open is enough to confirm that each is available.
+typedef struct {
+  int card_number;
+  int dev;
+  char properties[256];
+  device_capabilities capabilities;
+} subdevice_check;
+
+subdevice_check first_available_subdevice = {-1, -1, "", {0}};
+
+// What was found about each device reported, kept for use after the scan, e.g. for a snapshot.
+typedef struct {
+  playback_device device;
+  device_capabilities capabilities;
+  int mixer_count; // negative if the mixers weren't examined
+  mixer_analysis mixers[MAX_MIXERS];
+  measurement_summary measured;
+} device_record;
+
+device_record *device_records = NULL;
+int device_record_count = 0;
+static int device_record_capacity = 0;
+
+const char *snapshot_path = NULL; // if set, the capabilities of every device are checked fully
+
 // This array is of all the formats known to Shairport Sync, in order of the SPS_FORMAT definitions,
 // with their equivalent alsa codes and their frame sizes.
 // If just one format is requested, then its entry is searched for in the array and checked on the
@@ -233,98 +392,175 @@ const char *sps_format_description_string(sps_format_t format) {
     return sps_format_description_string_array[SPS_FORMAT_INVALID];
 }
 
-int check_alsa_device_with_settings(const char *device, snd_pcm_format_t sample_format,
-                                    unsigned int sample_rate) {
+static double monotonic_time_now(void) {
+  struct timespec tn;
+  clock_gettime(CLOCK_MONOTONIC, &tn);
+  return tn.tv_sec + tn.tv_nsec * 0.000000001;
+}
 
-  // returns 0 if successful, -SPS_EXPLORE_STATUS_CANT_SET_FORMAT if can't set format,
-  // -SPS_EXPLORE_STATUS_CANT_SET_SPEED if can't set speed -SPS_EXPLORE_STATUS_DEVICE_BUSY if device
-  // is busy, -SPS_EXPLORE_STATUS_DEVICE_CANT_BE_OPEN if device can't be opened
-  // -SPS_EXPLORE_STATUS_ERROR otherwise
+// Apply the optional software settings, returning 0 or a negative ALSA error code.
+static int apply_alsa_device_sw_settings(snd_pcm_t *handle, snd_pcm_sw_params_t *swparams,
+                                         const alsa_device_settings *settings) {
+  int ret = 0;
+  if (settings->set_tstamp_type != 0) {
+    ret = snd_pcm_sw_params_set_tstamp_type(handle, swparams, settings->tstamp_type);
+    if (ret != 0)
+      debug(1, "can not set timestamp type %d: %s.", settings->tstamp_type, snd_strerror(ret));
+  }
+  if ((ret == 0) && ((settings->explicit_start != 0) || (settings->free_running != 0))) {
+    snd_pcm_uframes_t boundary;
+    ret = snd_pcm_sw_params_get_boundary(swparams, &boundary);
+    // a start threshold beyond the buffer means the stream is never started by writing to it
+    if ((ret == 0) && (settings->explicit_start != 0))
+      ret = snd_pcm_sw_params_set_start_threshold(handle, swparams, boundary);
+    // with the stop threshold at the boundary, an underrun doesn't stop the stream
+    if ((ret == 0) && (settings->free_running != 0))
+      ret = snd_pcm_sw_params_set_stop_threshold(handle, swparams, boundary);
+  }
+  return ret;
+}
+
+int configure_alsa_device_with_settings(snd_pcm_t *alsa_handle, const char *device,
+                                        snd_pcm_format_t sample_format, unsigned int sample_rate,
+                                        const alsa_device_settings *settings) {
+  // returns 0 if successful or the negative of an sps_explore_status, as
+  // open_alsa_device_with_settings()
   int result = -SPS_EXPLORE_STATUS_ERROR;
   int ret, dir = 0;
-  ret = snd_pcm_open(&alsa_handle, device, SND_PCM_STREAM_PLAYBACK, 0);
+  snd_pcm_hw_params_t *alsa_params;
+  snd_pcm_sw_params_t *alsa_swparams;
+  snd_pcm_hw_params_alloca(&alsa_params);
+  snd_pcm_sw_params_alloca(&alsa_swparams);
+  ret = snd_pcm_hw_params_any(alsa_handle, alsa_params);
   if (ret == 0) {
-    snd_pcm_hw_params_alloca(&alsa_params);
-    snd_pcm_sw_params_alloca(&alsa_swparams);
-    ret = snd_pcm_hw_params_any(alsa_handle, alsa_params);
-    if (ret == 0) {
-
-      if ((snd_pcm_hw_params_set_access(alsa_handle, alsa_params, SND_PCM_ACCESS_RW_INTERLEAVED) ==
-           0) ||
-          (snd_pcm_hw_params_set_access(alsa_handle, alsa_params,
-                                        SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0)) {
-        ret = snd_pcm_hw_params_set_channels(alsa_handle, alsa_params, 2);
+
+    if ((snd_pcm_hw_params_set_access(alsa_handle, alsa_params, SND_PCM_ACCESS_RW_INTERLEAVED) ==
+         0) ||
+        (snd_pcm_hw_params_set_access(alsa_handle, alsa_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) ==
+         0)) {
+      ret = snd_pcm_hw_params_set_channels(alsa_handle, alsa_params, 2);
+      if (ret == 0) {
+        ret = snd_pcm_hw_params_set_format(alsa_handle, alsa_params, sample_format);
         if (ret == 0) {
-          ret = snd_pcm_hw_params_set_format(alsa_handle, alsa_params, sample_format);
-          if (ret == 0) {
-            unsigned int actual_sample_rate = sample_rate;
-            ret = snd_pcm_hw_params_set_rate_near(alsa_handle, alsa_params, &actual_sample_rate,
-                                                  &dir);
-            if ((ret == 0) && (actual_sample_rate != sample_rate))
-              debug(2, "Sample rate set, %u, is different to sample rate requested, %u.",
-                    actual_sample_rate, sample_rate);
-            if ((ret == 0) && (actual_sample_rate == sample_rate)) {
-              ret = snd_pcm_hw_params(alsa_handle, alsa_params);
+          unsigned int actual_sample_rate = sample_rate;
+          ret =
+              snd_pcm_hw_params_set_rate_near(alsa_handle, alsa_params, &actual_sample_rate, &dir);
+          if ((ret == 0) && (actual_sample_rate != sample_rate))
+            debug(2, "Sample rate set, %u, is different to sample rate requested, %u.",
+                  actual_sample_rate, sample_rate);
+          if ((ret == 0) && (actual_sample_rate == sample_rate)) {
+            if ((settings != NULL) && (settings->period_size != 0)) {
+              snd_pcm_uframes_t period_size = settings->period_size;
+              if (snd_pcm_hw_params_set_period_size_near(alsa_handle, alsa_params, &period_size,
+                                                         &dir) != 0)
+                debug(1, "can not set a period size of %lu frames for device \"%s\".",
+                      settings->period_size, device);
+            }
+            if ((settings != NULL) && (settings->buffer_size != 0)) {
+              snd_pcm_uframes_t buffer_size = settings->buffer_size;
+              if (snd_pcm_hw_params_set_buffer_size_near(alsa_handle, alsa_params,
+                                                         &buffer_size) != 0)
+                debug(1, "can not set a buffer size of %lu frames for device \"%s\".",
+                      settings->buffer_size, device);
+            }
+            ret = snd_pcm_hw_params(alsa_handle, alsa_params);
+            if (ret == 0) {
+              ret = snd_pcm_sw_params_current(alsa_handle, alsa_swparams);
               if (ret == 0) {
-                ret = snd_pcm_sw_params_current(alsa_handle, alsa_swparams);
+                ret = snd_pcm_sw_params_set_tstamp_mode(alsa_handle, alsa_swparams,
+                                                        SND_PCM_TSTAMP_ENABLE);
+                if ((ret == 0) && (settings != NULL))
+                  ret = apply_alsa_device_sw_settings(alsa_handle, alsa_swparams, settings);
                 if (ret == 0) {
-                  ret = snd_pcm_sw_params_set_tstamp_mode(alsa_handle, alsa_swparams,
-                                                          SND_PCM_TSTAMP_ENABLE);
+                  /* write the sw parameters */
+                  ret = snd_pcm_sw_params(alsa_handle, alsa_swparams);
                   if (ret == 0) {
-                    /* write the sw parameters */
-                    ret = snd_pcm_sw_params(alsa_handle, alsa_swparams);
-                    if (ret == 0) {
-                      result = 0; // success
-                    } else {
-                      debug(1, "unable to set software parameters of device: \"%s\": %s.", card,
-                            snd_strerror(ret));
-                    }
+                    result = 0; // success
                   } else {
-                    debug(1, "can not enable timestamp mode of device: \"%s\": %s.", card,
+                    debug(1, "unable to set software parameters of device: \"%s\": %s.", card,
                           snd_strerror(ret));
+                    result = -SPS_EXPLORE_STATUS_DEVICE_CANT_SET_SW_PARAMS;
                   }
                 } else {
-
-                  debug(1,
-                        "unable to get software parameters for device \"%s\": "
-                        "%s.",
-                        card, snd_strerror(ret));
+                  debug(1, "can not enable timestamp mode of device: \"%s\": %s.", card,
+                        snd_strerror(ret));
+                  result = -SPS_EXPLORE_STATUS_DEVICE_CANT_SET_SW_PARAMS;
                 }
               } else {
-                debug(1, "unable to set hardware parameters for device \"%s\": %s.", card,
-                      snd_strerror(ret));
-                result =
-                    -SPS_EXPLORE_STATUS_DEVICE_CANT_SET_HW_PARAMS; // -SPS_EXPLORE_STATUS_DEVICE_CANT_SET_HW_PARAMS
-                                                                   // means the device finally
-                                                                   // complained when writing
-                                                                   // the hardware settings
+
+                debug(1,
+                      "unable to get software parameters for device \"%s\": "
+                      "%s.",
+                      card, snd_strerror(ret));
               }
             } else {
-              debug(2, "could not set output rate %u for device \"%s\": %s", actual_sample_rate,
-                    card, snd_strerror(ret));
-              result = -SPS_EXPLORE_STATUS_CANT_SET_SPEED; // -SPS_EXPLORE_STATUS_CANT_SET_SPEED
-                                                           // means can't set rate
+              debug(1, "unable to set hardware parameters for device \"%s\": %s.", card,
+                    snd_strerror(ret));
+              result =
+                  -SPS_EXPLORE_STATUS_DEVICE_CANT_SET_HW_PARAMS; // -SPS_EXPLORE_STATUS_DEVICE_CANT_SET_HW_PARAMS
+                                                                 // means the device finally
+                                                                 // complained when writing
+                                                                 // the hardware settings
             }
           } else {
-            debug(2, "could not set output format %d for device \"%s\": %s", sample_format, card,
-                  snd_strerror(ret));
-            result = -SPS_EXPLORE_STATUS_CANT_SET_FORMAT;
+            debug(2, "could not set output rate %u for device \"%s\": %s", actual_sample_rate,
+                  card, snd_strerror(ret));
+            result = -SPS_EXPLORE_STATUS_CANT_SET_SPEED; // -SPS_EXPLORE_STATUS_CANT_SET_SPEED
+                                                         // means can't set rate
           }
         } else {
-          debug(1, "stereo output not available for device \"%s\": %s", card, snd_strerror(ret));
+          debug(2, "could not set output format %d for device \"%s\": %s", sample_format, card,
+                snd_strerror(ret));
+          result = -SPS_EXPLORE_STATUS_CANT_SET_FORMAT;
         }
       } else {
-        debug(1, "interleaved access not available for device \"%s\": %s", card, snd_strerror(ret));
+        debug(1, "stereo output not available for device \"%s\": %s", card, snd_strerror(ret));
       }
     } else {
-      debug(1,
-            "broken configuration for device \"%s\": no configurations "
-            "available",
-            card);
+      debug(1, "interleaved access not available for device \"%s\": %s", card, snd_strerror(ret));
     }
-    // now close the device
-    snd_pcm_close(alsa_handle);
   } else {
+    debug(1,
+          "broken configuration for device \"%s\": no configurations "
+          "available",
+          card);
+  }
+  // the access is tried without keeping the error, but ALSA gives -EINVAL for it
+  if ((result != 0) && (settings != NULL) && (settings->alsa_error != NULL))
+    *settings->alsa_error = ret != 0 ? ret : -EINVAL;
+  return result;
+}
+
+int open_alsa_device_with_settings(const char *device, snd_pcm_format_t sample_format,
+                                   unsigned int sample_rate, const alsa_device_settings *settings,
+                                   snd_pcm_t **handle) {
+
+  // returns 0 if successful, -SPS_EXPLORE_STATUS_CANT_SET_FORMAT if can't set format,
+  // -SPS_EXPLORE_STATUS_CANT_SET_SPEED if can't set speed -SPS_EXPLORE_STATUS_DEVICE_BUSY if device
+  // is busy, -SPS_EXPLORE_STATUS_DEVICE_CANT_BE_OPEN if device can't be opened
+  // -SPS_EXPLORE_STATUS_ERROR otherwise
+  int result = -SPS_EXPLORE_STATUS_ERROR;
+  int ret;
+  snd_pcm_t *alsa_handle;
+  double start_time = monotonic_time_now();
+  ret = snd_pcm_open(&alsa_handle, device, SND_PCM_STREAM_PLAYBACK, 0);
+  pcm_open_count++;
+  double open_time = monotonic_time_now();
+  if ((settings != NULL) && (settings->timing != NULL))
+    settings->timing->open = open_time - start_time;
+  if (ret == 0) {
+    result = configure_alsa_device_with_settings(alsa_handle, device, sample_format, sample_rate,
+                                                 settings);
+    // close the device unless it's ready to be used
+    if ((settings != NULL) && (settings->timing != NULL))
+      settings->timing->configure = monotonic_time_now() - open_time;
+    if (result == 0)
+      *handle = alsa_handle;
+    else
+      snd_pcm_close(alsa_handle);
+  } else {
+    if ((settings != NULL) && (settings->alsa_error != NULL))
+      *settings->alsa_error = ret;
     if (ret == -ENODEV) {
       debug(1, "the alsa output_device \"%s\" can not be opened.", device);
       result = -SPS_EXPLORE_STATUS_DEVICE_CANT_BE_OPENED;
@@ -341,8 +577,19 @@ int check_alsa_device_with_settings(const char *device, snd_pcm_format_t sample_
   return result;
 }
 
-int check_alsa_device(const char *device, int quiet, int stop_on_first_success,
-                      int check_alternate_speeds) {
+int check_alsa_device_with_settings(const char *device, snd_pcm_format_t sample_format,
+                                    unsigned int sample_rate) {
+  snd_pcm_t *handle;
+  int result = open_alsa_device_with_settings(device, sample_format, sample_rate, NULL, &handle);
+  if (result == 0)
+    snd_pcm_close(handle);
+  return result;
+}
+
+// Check every combination of the speeds and formats Shairport Sync might use (or the alternate
+// speeds). If formats_found is not NULL, for each speed, a bit (1 << sps_format_t) is set in the
+// corresponding element for every format accepted.
+int check_alsa_device(const char *device, int check_alternate_speeds, uint32_t *formats_found) {
   int response = 0;
   int number_of_formats_to_try = sizeof(format_check_sequence) / sizeof(sps_format_t);
   int number_of_speeds_to_try = sizeof(auto_speed_output_rates) / sizeof(int);
@@ -351,6 +598,8 @@ int check_alsa_device(const char *device, int quiet, int stop_on_first_success,
     number_of_speeds_to_try = sizeof(alternate_speed_output_rates) / sizeof(int);
     speeds = alternate_speed_output_rates;
   }
+  if (formats_found != NULL)
+    memset(formats_found, 0, number_of_speeds_to_try * sizeof(uint32_t));
 
   int ret;
   int i = 0;
@@ -358,11 +607,6 @@ int check_alsa_device(const char *device, int quiet, int stop_on_first_success,
   do {
     // pick next speed to check
     unsigned int sample_rate = speeds[i];
-    int number_of_successes = 0;
-    char information_string[1024];
-    information_string[0] = '\0';
-    snprintf(information_string, sizeof(information_string) - 1 - strlen(information_string),
-             "     %-6u", sample_rate);
     // pick formats
     int j = 0;
     do {
@@ -370,7 +614,15 @@ int check_alsa_device(const char *device, int quiet, int stop_on_first_success,
       snd_pcm_format_t sample_format = fr[format_check_sequence[j]].alsa_code;
       const char *desc = sps_format_description_string_array[format_check_sequence[j]];
       // debug(1, "check %d, %s", sample_rate, desc );
-      ret = check_alsa_device_with_settings(device, sample_format, sample_rate);
+      if ((prescreen != NULL) &&
+          (proc_asound_prediction_allows(prescreen, sample_format, 2, sample_rate) == 0)) {
+        ret = -SPS_EXPLORE_STATUS_CANT_SET_FORMAT; // no need to open the device to find out
+        prescreen_skip_count++;
+      } else if (no_open != 0) {
+        ret = prescreen != NULL ? 0 : -SPS_EXPLORE_STATUS_NO_INFORMATION;
+      } else {
+        ret = check_alsa_device_with_settings(device, sample_format, sample_rate);
+      }
       debug(2, "check %d, %s, result: %d.", sample_rate, desc, ret);
       // -SPS_EXPLORE_STATUS_CANT_SET_FORMAT and -SPS_EXPLORE_STATUS_CANT_SET_SPEED mean the format
       // or speed was not suitable and -SPS_EXPLORE_STATUS_DEVICE_CANT_SET_HW_PARAMS means some
@@ -381,35 +633,429 @@ int check_alsa_device(const char *device, int quiet, int stop_on_first_success,
                                                                   // individual rejected setting
         response = ret;
 
-      j++;
       if (ret == 0) {
-        if (number_of_successes == 0)
-          snprintf(information_string + strlen(information_string),
-                   sizeof(information_string) - 1 - strlen(information_string), "            %s",
-                   desc);
-        else
-          snprintf(information_string + strlen(information_string),
-                   sizeof(information_string) - 1 - strlen(information_string), ",%s", desc);
-        number_of_successes++;
+        if (formats_found != NULL)
+          formats_found[i] |= 1 << format_check_sequence[j];
         response++;
       }
-    } while ((j < number_of_formats_to_try) && (response >= 0) &&
-             (!((stop_on_first_success != 0) && (response == 1))));
-    if ((number_of_successes > 0) && (quiet == 0))
-      inform(information_string);
+      j++;
+    } while ((j < number_of_formats_to_try) && (response >= 0));
     if ((ret != 0) && (ret != -SPS_EXPLORE_STATUS_CANT_SET_FORMAT) &&
         (ret != -SPS_EXPLORE_STATUS_CANT_SET_SPEED) &&
         (ret != -SPS_EXPLORE_STATUS_DEVICE_CANT_SET_HW_PARAMS)) // these errors are ignored as they
                                                                 // are transient
       response = ret;
     i++;
-  } while ((i < number_of_speeds_to_try) && (response >= 0) &&
-           (!((stop_on_first_success != 0) && (response == 1))));
+  } while ((i < number_of_speeds_to_try) && (response >= 0));
   return response; // negative if some error, number of successes otherwise
 }
 
-static int cards(void) {
+// Print the speeds and formats found by check_alsa_device(), one line per speed.
+// If stop_on_first_success is set, print only the first -- the one Shairport Sync would choose.
+void print_speeds_and_formats(const uint32_t *formats_found, int check_alternate_speeds,
+                              int stop_on_first_success) {
+  int number_of_formats = sizeof(format_check_sequence) / sizeof(sps_format_t);
+  int number_of_speeds = sizeof(auto_speed_output_rates) / sizeof(int);
+  unsigned int *speeds = auto_speed_output_rates;
+  if (check_alternate_speeds != 0) {
+    number_of_speeds = sizeof(alternate_speed_output_rates) / sizeof(int);
+    speeds = alternate_speed_output_rates;
+  }
+  int i;
+  for (i = 0; i < number_of_speeds; i++) {
+    if (formats_found[i] == 0)
+      continue;
+    char information_string[1024];
+    int number_of_successes = 0;
+    snprintf(information_string, sizeof(information_string) - 1, "     %-6u", speeds[i]);
+    int j;
+    for (j = 0; j < number_of_formats; j++) {
+      if ((formats_found[i] & (1 << format_check_sequence[j])) == 0)
+        continue;
+      const char *desc = sps_format_description_string_array[format_check_sequence[j]];
+      if (number_of_successes == 0)
+        snprintf(information_string + strlen(information_string),
+                 sizeof(information_string) - 1 - strlen(information_string), "            %s",
+                 desc);
+      else
+        snprintf(information_string + strlen(information_string),
+                 sizeof(information_string) - 1 - strlen(information_string), ",%s", desc);
+      number_of_successes++;
+      if (stop_on_first_success != 0)
+        break;
+    }
+    inform(information_string);
+    if (stop_on_first_success != 0)
+      break;
+  }
+}
+
+// Find the speed and format Shairport Sync would choose, i.e. the first found.
+// Returns 0 if there is one.
+int first_speed_and_format(const uint32_t *formats_found, unsigned int *speed,
+                           sps_format_t *format) {
+  int number_of_formats = sizeof(format_check_sequence) / sizeof(sps_format_t);
+  int number_of_speeds = sizeof(auto_speed_output_rates) / sizeof(int);
+  int i, j;
+  for (i = 0; i < number_of_speeds; i++) {
+    for (j = 0; j < number_of_formats; j++) {
+      if (formats_found[i] & (1 << format_check_sequence[j])) {
+        *speed = auto_speed_output_rates[i];
+        *format = format_check_sequence[j];
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+// Report the settings and state of the open subdevice(s) of a busy playback device using only
+// /proc/asound, i.e. without opening it. If sub_device is negative, every subdevice is examined.
+// Returns the number of open subdevices found.
+static int report_busy_device(int card_number, int dev, int sub_device, int sub_device_count) {
+  int open_substreams_found = 0;
+  int first_sub_device = sub_device >= 0 ? sub_device : 0;
+  int last_sub_device = sub_device >= 0 ? sub_device : sub_device_count - 1;
+  pid_t pid_using_device = -1; // not looked for yet
+  int s;
+  for (s = first_sub_device; s <= last_sub_device; s++) {
+    proc_asound_substream substream;
+    if ((proc_asound_substream_read(card_number, dev, s, SND_PCM_STREAM_PLAYBACK, &substream) !=
+         0) ||
+        (substream.setup == PROC_ASOUND_SUBSTREAM_CLOSED))
+      continue;
+    if (open_substreams_found == 0)
+      inform("  This device is already in use. Its current settings, read from /proc/asound, are:");
+    open_substreams_found++;
+    if (sub_device_count > 1)
+      inform("    Subdevice:         %d", s);
+    pid_t owner = substream.owner_pid;
+    if (owner <= 0) {
+      // older kernels don't report the owner, so look for a process with the device open
+      if (pid_using_device < 0)
+        pid_using_device =
+            proc_asound_find_pid_using(card_number, dev, SND_PCM_STREAM_PLAYBACK);
+      owner = pid_using_device;
+    }
+    if (owner > 0) {
+      char process_name[64];
+      if (proc_asound_process_name(owner, process_name, sizeof(process_name)) == 0)
+        inform("    In use by:         process %d (\"%s\")", owner, process_name);
+      else
+        inform("    In use by:         process %d", owner);
+    } else {
+      inform("    In use by:         (can not be determined)");
+    }
+    if (substream.setup == PROC_ASOUND_SUBSTREAM_NO_SETUP) {
+      inform("    State:             OPEN (not yet configured)");
+      continue;
+    }
+    inform("    State:             %s", substream.state[0] != '\0' ? substream.state : "unknown");
+    inform("    Rate:              %u", substream.rate);
+    inform("    Format:            %s", substream.format);
+    inform("    Channels:          %u", substream.channels);
+    inform("    Buffer Size:       %lu frames", substream.buffer_size);
+    inform("    Period Size:       %lu frames", substream.period_size);
+    inform("    Delay:             %ld frames", substream.delay);
+    if (extended_output != 0) {
+      inform("    Access:            %s", substream.access);
+      inform("    Available:         %ld frames", substream.avail);
+      inform("    Start Threshold:   %lu frames", substream.start_threshold);
+      inform("    Stop Threshold:    %lu frames", substream.stop_threshold);
+      inform("    Timestamp Mode:    %s", substream.tstamp_mode);
+      inform("    Hardware Pointer:  %lu", substream.hw_ptr);
+      inform("    Appl. Pointer:     %lu", substream.appl_ptr);
+    }
+  }
+  return open_substreams_found;
+}
+
+// Present the simplest names for a device: omit the subdevice unless every subdevice is being
+// checked, and omit the device number too if it's zero.
+static void make_device_names(char *device_name, char *short_name, const char *device_type,
+                              const char *card_id, int card_number, int dev, int sub_device,
+                              int sub_device_count) {
+  if ((sub_device_count <= 1) || (check_subdevices == 0)) {
+    if (dev == 0) {
+      sprintf(device_name, "%s:%s", device_type, card_id);
+      sprintf(short_name, "%s:%i", device_type, card_number);
+    } else {
+      sprintf(device_name, "%s:CARD=%s,DEV=%i", device_type, card_id, dev);
+      sprintf(short_name, "%s:%i,%i", device_type, card_number, dev);
+    }
+  } else {
+    sprintf(device_name, "%s:CARD=%s,DEV=%i,SUBDEV=%i", device_type, card_id, dev, sub_device);
+    sprintf(short_name, "%s:%i,%i,%i", device_type, card_number, dev, sub_device);
+  }
+}
+
+// If sub_device is negative, the device is busy if none of its subdevices is available.
+static int device_is_busy_according_to_proc(int card_number, int dev, int sub_device) {
   int response = 0;
+  if (sub_device >= 0) {
+    proc_asound_substream substream;
+    if ((proc_asound_substream_read(card_number, dev, sub_device, SND_PCM_STREAM_PLAYBACK,
+                                    &substream) == 0) &&
+        (substream.setup != PROC_ASOUND_SUBSTREAM_CLOSED))
+      response = 1;
+  } else {
+    proc_asound_pcm_info pcm_info;
+    if ((proc_asound_pcm_info_read(card_number, dev, 0, SND_PCM_STREAM_PLAYBACK, &pcm_info) ==
+         0) &&
+        (pcm_info.subdevices_avail == 0))
+      response = 1;
+  }
+  return response;
+}
+
+// Check the rates Shairport Sync doesn't use, unless they have been checked already.
+static void check_alternate_speeds(const char *device_name, device_capabilities *capabilities) {
+  if (capabilities->alternates_checked == 0) {
+    capabilities->alternate_status =
+        check_alsa_device(device_name, 1, capabilities->alternate_formats);
+    capabilities->alternates_checked = 1;
+  }
+}
+
+// Check a subdevice, reusing the check of the first available subdevice of the same device if
+// its properties are identical.
+static int check_subdevice(const char *device_name, int card_number, int dev,
+                           const char *properties, device_capabilities *capabilities) {
+  if ((first_available_subdevice.card_number == card_number) &&
+      (first_available_subdevice.dev == dev) &&
+      (strcmp(first_available_subdevice.properties, properties) == 0)) {
+    unsigned int speed;
+    sps_format_t format;
+    if (first_speed_and_format(first_available_subdevice.capabilities.formats, &speed, &format) ==
+        0) {
+      int ret = check_alsa_device_with_settings(device_name, fr[format].alsa_code, speed);
+      if (ret == 0) {
+        debug(2, "\"%s\" is available and is taken to be the same as the first subdevice checked.",
+              device_name);
+        *capabilities = first_available_subdevice.capabilities;
+        return capabilities->status;
+      } else if (ret == -SPS_EXPLORE_STATUS_DEVICE_BUSY) {
+        return ret;
+      }
+      debug(1, "\"%s\" differs from the first subdevice checked, so it will be checked fully.",
+            device_name);
+    }
+  }
+  return check_alsa_device(device_name, 0, capabilities->formats);
+}
+
+// Get the rates, in ascending order, at which the device was found to accept the format.
+static int rates_for_format(const device_capabilities *capabilities, sps_format_t format,
+                            unsigned int *rates) {
+  int rate_count = 0;
+  size_t i;
+  for (i = 0; i < sizeof(auto_speed_output_rates) / sizeof(int); i++)
+    if (capabilities->formats[i] & (1 << format))
+      rates[rate_count++] = auto_speed_output_rates[i];
+  if (capabilities->alternates_checked != 0)
+    for (i = 0; i < sizeof(alternate_speed_output_rates) / sizeof(int); i++)
+      if (capabilities->alternate_formats[i] & (1 << format))
+        rates[rate_count++] = alternate_speed_output_rates[i];
+  // insertion sort, as there are only a few
+  int j, k;
+  for (j = 1; j < rate_count; j++) {
+    unsigned int rate = rates[j];
+    for (k = j; (k > 0) && (rates[k - 1] > rate); k--)
+      rates[k] = rates[k - 1];
+    rates[k] = rate;
+  }
+  return rate_count;
+}
+
+static void remember_first_available_subdevice(int card_number, int dev, const char *properties,
+                                               const device_capabilities *capabilities) {
+  if ((first_available_subdevice.card_number != card_number) ||
+      (first_available_subdevice.dev != dev) ||
+      (strcmp(first_available_subdevice.properties, properties) != 0)) {
+    first_available_subdevice.card_number = card_number;
+    first_available_subdevice.dev = dev;
+    snprintf(first_available_subdevice.properties, sizeof(first_available_subdevice.properties),
+             "%s", properties);
+    first_available_subdevice.capabilities = *capabilities;
+  }
+}
+
+static void record_device(const playback_device *d, const device_capabilities *capabilities,
+                          int mixers_examined, const measurement_summary *measured) {
+  if (device_record_count == device_record_capacity) {
+    int capacity = device_record_capacity == 0 ? 16 : device_record_capacity * 2;
+    device_record *records = realloc(device_records, capacity * sizeof(device_record));
+    if (records == NULL)
+      die("can not allocate memory to record the devices found.");
+    device_records = records;
+    device_record_capacity = capacity;
+  }
+  device_record *r = &device_records[device_record_count++];
+  memset(r, 0, sizeof(device_record));
+  r->device = *d;
+  r->capabilities = *capabilities;
+  r->measured = *measured;
+  r->mixer_count = -1;
+  if ((mixers_examined != 0) && (strcmp(card_mixers.card, card) == 0)) {
+    r->mixer_count = card_mixers.count > 0 ? card_mixers.count : 0;
+    memcpy(r->mixers, card_mixers.mixers, r->mixer_count * sizeof(mixer_analysis));
+  }
+}
+
+// Check and report on a device. Unless no_open is set, this opens the device, though combinations
+// of rate and format that /proc/asound shows can not work are screened out beforehand.
+static void report_device(const playback_device *d) {
+  const char *device_name = d->device_name;
+  int card_number = d->card_number;
+  int dev = d->dev;
+  int sub_device_count = d->sub_device_count;
+  int specific_sub_device =
+      (sub_device_count > 1) && (check_subdevices != 0) ? d->sub_device : -1;
+  proc_asound_prediction prediction;
+  if (proc_asound_predict(card_number, dev, SND_PCM_STREAM_PLAYBACK, &prediction) == 0)
+    prescreen = &prediction;
+  device_capabilities capabilities;
+  memset(&capabilities, 0, sizeof(capabilities));
+  measurement_summary measured = {0.0, -1, 0.0};
+  int screening_status;
+  if (no_open == 0) {
+    if (specific_sub_device >= 0)
+      screening_status =
+          check_subdevice(device_name, card_number, dev, d->properties, &capabilities);
+    else
+      screening_status = check_alsa_device(device_name, 0, capabilities.formats);
+  } else if (device_is_busy_according_to_proc(card_number, dev, specific_sub_device) != 0) {
+    screening_status = -SPS_EXPLORE_STATUS_DEVICE_BUSY;
+  } else if (prescreen == NULL) {
+    screening_status = -SPS_EXPLORE_STATUS_NO_INFORMATION;
+  } else {
+    screening_status = check_alsa_device(device_name, 0, capabilities.formats);
+    // a card-wide prediction can't say whether this device in particular is suitable
+    if ((screening_status > 0) && (prescreen->card_wide != 0))
+      screening_status = -SPS_EXPLORE_STATUS_CARD_WIDE_INFORMATION;
+  }
+  capabilities.status = screening_status;
+  if ((screening_status >= 0) || (extended_output != 0) ||
+      (screening_status == -SPS_EXPLORE_STATUS_DEVICE_BUSY) ||
+      (screening_status == -SPS_EXPLORE_STATUS_524_ERROR) ||
+      (screening_status == -SPS_EXPLORE_STATUS_DEVICE_CANT_BE_OPENED) ||
+      (screening_status == -SPS_EXPLORE_STATUS_NO_INFORMATION) ||
+      (screening_status == -SPS_EXPLORE_STATUS_CARD_WIDE_INFORMATION)) {
+    inform("> Device Full Name:    \"%s\"", device_name);
+    inform("  Short Name:          \"%s\"", d->short_name);
+    if ((sub_device_count > 1) && (check_subdevices == 0) && (extended_output))
+      inform("  Subdevices:           %i", sub_device_count);
+    if (extended_output != 0) {
+      inform("    Card Name:         \"%s\"", d->card_name);
+      inform("    Device ID:         \"%s\"", d->device_id);
+      inform("    Device Name:       \"%s\"", d->device_long_name);
+      inform("    Subdevice Name:    \"%s\"", d->subdevice_name);
+      if (prescreen != NULL)
+        inform("    Capabilities From: \"%s\"", prescreen->source);
+    }
+
+    if (screening_status > 0) {
+      inform("  This device seems suitable for use with Shairport Sync.");
+      if (no_open != 0) {
+        if (extended_output == 0)
+          inform("  (Predicted from \"%s\" without opening the device.)", prescreen->source);
+        else
+          inform("    Mixers are not examined when the \"--no-open\" option is used.");
+      } else if (load_mixers() > 0) {
+        print_mixers("  Possible mixers:     ", "                       ");
+      } else {
+        if (extended_output != 0)
+          inform("    No mixers usable by Shairport Sync.");
+      }
+      if (snapshot_path != NULL)
+        check_alternate_speeds(device_name, &capabilities);
+      if (extended_output == 0) {
+        inform("  The following rate and format would be chosen by Shairport Sync in "
+               "\"auto\" "
+               "mode:");
+        inform("     Rate              Format");
+        print_speeds_and_formats(capabilities.formats, 0, 1);
+      } else {
+        inform("    Suitable rates and formats (suggested setting first):");
+        inform("     Rate              Formats");
+        print_speeds_and_formats(capabilities.formats, 0, 0);
+        inform("    Other rates and formats not compatible with Shairport Sync:");
+        inform("     Rate              Formats");
+        check_alternate_speeds(device_name, &capabilities);
+        print_speeds_and_formats(capabilities.alternate_formats, 1, 0);
+      }
+      unsigned int speed;
+      sps_format_t format;
+      if ((no_open == 0) && (measurements_requested() != 0) &&
+          (first_speed_and_format(capabilities.formats, &speed, &format) == 0)) {
+        unsigned int rates[sizeof(auto_speed_output_rates) / sizeof(int) +
+                           sizeof(alternate_speed_output_rates) / sizeof(int)];
+        if (measurements.rate_switch_runs != 0)
+          check_alternate_speeds(device_name, &capabilities);
+        int rate_count = rates_for_format(&capabilities, format, rates);
+        measure_device(device_name, fr[format].alsa_code, speed, rates, rate_count, &measured);
+      }
+    } else if (screening_status == -SPS_EXPLORE_STATUS_DEVICE_BUSY) {
+      if (report_busy_device(card_number, dev, specific_sub_device, sub_device_count) > 0) {
+        inform("  To check it fully, take it out of use and try again.");
+      } else {
+        inform("  This device is already in use and can not be checked.");
+        inform("  To check it, take it out of use and try again.");
+      }
+    } else if (screening_status == -SPS_EXPLORE_STATUS_NO_INFORMATION) {
+      inform("  The capabilities of this device are not published in /proc/asound.");
+      inform("  To check it, run this tool again without the \"--no-open\" option.");
+    } else if (screening_status == -SPS_EXPLORE_STATUS_CARD_WIDE_INFORMATION) {
+      inform("  The rates and formats in \"%s\" are those of the card as a whole,",
+             prescreen->source);
+      inform("  not necessarily of this device, so it can't be said whether it is suitable.");
+      if (extended_output != 0) {
+        inform("    Suitable rates and formats accepted by some device on the card:");
+        inform("     Rate              Formats");
+        print_speeds_and_formats(capabilities.formats, 0, 0);
+      }
+      inform("  To check this device, run this tool again without the \"--no-open\" option.");
+      memset(capabilities.formats, 0, sizeof(capabilities.formats)); // not this device's
+    } else if (screening_status == -SPS_EXPLORE_STATUS_524_ERROR) {
+      inform("  This HDMI port is not initialised. To use it:");
+      inform("   (1) connect it up to the output device,");
+      inform("   (2) turn on the output device and select this device as input,");
+      inform("   (3) reboot and try again.");
+    } else if (screening_status == -SPS_EXPLORE_STATUS_DEVICE_CANT_BE_OPENED) {
+      inform("  This device can not be accessed and so can not be checked.");
+      inform("  (Does it need to be configured or connected?)");
+    } else {
+      check_alternate_speeds(device_name, &capabilities);
+      if (capabilities.alternate_status > 0)
+        inform("  Shairport Sync can not use this device because it does not accept "
+               "suitable audio formats.");
+      else
+        inform("  Shairport Sync can not use this device.");
+    }
+
+    /*
+    // subdevices
+    int count = snd_pcm_info_get_subdevices_count(pcminfo);
+    inform("  Subdevices: %i/%i", snd_pcm_info_get_subdevices_avail(pcminfo), count);
+    int idx;
+    for (idx = 0; idx < (int)count; idx++) {
+            snd_pcm_info_set_subdevice(pcminfo, idx);
+            if ((err = snd_ctl_pcm_info(handle, pcminfo)) < 0) {
+                    debug(1,"control digital audio playback info (%i): %s", card,
+    snd_strerror(err)); } else { printf("  Subdevice #%i: %s\n", idx,
+    snd_pcm_info_get_subdevice_name(pcminfo));
+            }
+    }
+    */
+    inform(""); // newline
+    record_device(d, &capabilities, (screening_status > 0) && (no_open == 0), &measured);
+  }
+  if ((specific_sub_device >= 0) && (screening_status > 0) && (no_open == 0))
+    remember_first_available_subdevice(card_number, dev, d->properties, &capabilities);
+  prescreen = NULL;
+}
+
+void enumerate_playback_devices(playback_device_visitor visitor, void *context) {
   snd_ctl_t *handle;
   int card_number, err, dev;
   snd_ctl_card_info_t *info;
@@ -487,114 +1133,38 @@ static int cards(void) {
           if (err != -ENOENT)
             debug(1, "snd_ctl_pcm_info error for card %i, subdevice %i: %s", card_number,
                   sub_device, snd_strerror(err));
+          sub_device++; // or, with -s, this subdevice would be asked about forever
           continue;
         }
-        char device_name[128];
-        char short_name[128];
-        if ((sub_device_count <= 1) || (check_subdevices == 0)) {
-          if (dev == 0) {
-            sprintf(device_name, "%s:%s", device_type, snd_ctl_card_info_get_id(info));
-            sprintf(short_name, "%s:%i", device_type, card_number);
-          } else {
-            sprintf(device_name, "%s:CARD=%s,DEV=%i", device_type, snd_ctl_card_info_get_id(info),
-                    dev);
-            sprintf(short_name, "%s:%i,%i", device_type, card_number, dev);
-          }
-        } else {
-          sprintf(device_name, "%s:CARD=%s,DEV=%i,SUBDEV=%i", device_type,
-                  snd_ctl_card_info_get_id(info), dev, sub_device);
-          sprintf(short_name, "%s:%i,%i,%i", device_type, card_number, dev, sub_device);
-        }
-        debug(2, "device name: \"%s\"", device_name);
+        playback_device d;
+        memset(&d, 0, sizeof(d));
+        d.card_number = card_number;
+        d.dev = dev;
+        d.sub_device = sub_device;
+        d.sub_device_count = sub_device_count;
+        make_device_names(d.device_name, d.short_name, device_type,
+                          snd_ctl_card_info_get_id(info), card_number, dev, sub_device,
+                          sub_device_count);
+        snprintf(d.card_id, sizeof(d.card_id), "%s", snd_ctl_card_info_get_id(info));
+        snprintf(d.card_name, sizeof(d.card_name), "%s", snd_ctl_card_info_get_name(info));
+        snprintf(d.device_id, sizeof(d.device_id), "%s", snd_pcm_info_get_id(pcminfo));
+        snprintf(d.device_long_name, sizeof(d.device_long_name), "%s",
+                 snd_pcm_info_get_name(pcminfo));
+        snprintf(d.subdevice_name, sizeof(d.subdevice_name), "%s",
+                 snd_pcm_info_get_subdevice_name(pcminfo));
+        debug(2, "device name: \"%s\"", d.device_name);
         if (check_subdevices == 0)
           debug(2, "card: %d, device: %d", card_number, dev);
         else
           debug(2, "card: %d, device: %d, sub_device: %d", card_number, dev, sub_device);
 
-        int screening_status = check_alsa_device(device_name, 1, 0, 0);
-        if ((screening_status >= 0) || (extended_output != 0) ||
-            (screening_status == -SPS_EXPLORE_STATUS_DEVICE_BUSY) ||
-            (screening_status == -SPS_EXPLORE_STATUS_524_ERROR) ||
-            (screening_status == -SPS_EXPLORE_STATUS_DEVICE_CANT_BE_OPENED)) {
-          inform("> Device Full Name:    \"%s\"", device_name);
-          inform("  Short Name:          \"%s\"", short_name);
-          if ((sub_device_count > 1) && (check_subdevices == 0) && (extended_output))
-            inform("  Subdevices:           %i", sub_device_count);
-          if (extended_output != 0) {
-            inform("    Card Name:         \"%s\"", snd_ctl_card_info_get_name(info));
-            inform("    Device ID:         \"%s\"", snd_pcm_info_get_id(pcminfo));
-            inform("    Device Name:       \"%s\"", snd_pcm_info_get_name(pcminfo));
-            inform("    Subdevice Name:    \"%s\"", snd_pcm_info_get_subdevice_name(pcminfo));
-          }
-
-          if (screening_status > 0) {
-            inform("  This device seems suitable for use with Shairport Sync.");
-            if ((selems_if_has_db_playback(0, NULL, NULL)) ||
-                (selems_if_has_db_playback(1, NULL, NULL))) {
-
-              char fp[] = "  Possible mixers:     ";
-              char sp[] = "                       ";
-              int found =
-                  selems_if_has_db_playback(0, fp,
-                                            sp); // omit mixers that also have a capture part
-              if (found > 0)
-                selems_if_has_db_playback(1, sp,
-                                          sp); // include mixers that also have a capture part
-              else
-                selems_if_has_db_playback(1, fp,
-                                          sp); // include mixers that also have a capture part
-            } else {
-              if (extended_output != 0)
-                inform("    No mixers usable by Shairport Sync.");
-            }
-            if (extended_output == 0) {
-              inform("  The following rate and format would be chosen by Shairport Sync in "
-                     "\"auto\" "
-                     "mode:");
-              inform("     Rate              Format");
-              check_alsa_device(device_name, 0, 1, 0);
-            } else {
-              inform("    Suitable rates and formats (suggested setting first):");
-              inform("     Rate              Formats");
-              check_alsa_device(device_name, 0, 0, 0);
-              inform("    Other rates and formats not compatible with Shairport Sync:");
-              inform("     Rate              Formats");
-              check_alsa_device(device_name, 0, 0, 1);
-            }
-          } else if (screening_status == -SPS_EXPLORE_STATUS_DEVICE_BUSY) {
-            inform("  This device is already in use and can not be checked.");
-            inform("  To check it, take it out of use and try again.");
-          } else if (screening_status == -SPS_EXPLORE_STATUS_524_ERROR) {
-            inform("  This HDMI port is not initialised. To use it:");
-            inform("   (1) connect it up to the output device,");
-            inform("   (2) turn on the output device and select this device as input,");
-            inform("   (3) reboot and try again.");
-          } else if (screening_status == -SPS_EXPLORE_STATUS_DEVICE_CANT_BE_OPENED) {
-            inform("  This device can not be accessed and so can not be checked.");
-            inform("  (Does it need to be configured or connected?)");
-          } else if (check_alsa_device(device_name, 1, 0, 1) > 0) {
-            inform("  Shairport Sync can not use this device because it does not accept "
-                   "suitable audio formats.");
-          } else {
-            inform("  Shairport Sync can not use this device.");
-          }
-
-          /*
-          // subdevices
-          int count = snd_pcm_info_get_subdevices_count(pcminfo);
-          inform("  Subdevices: %i/%i", snd_pcm_info_get_subdevices_avail(pcminfo), count);
-          int idx;
-          for (idx = 0; idx < (int)count; idx++) {
-                  snd_pcm_info_set_subdevice(pcminfo, idx);
-                  if ((err = snd_ctl_pcm_info(handle, pcminfo)) < 0) {
-                          debug(1,"control digital audio playback info (%i): %s", card,
-          snd_strerror(err)); } else { printf("  Subdevice #%i: %s\n", idx,
-          snd_pcm_info_get_subdevice_name(pcminfo));
-                  }
-          }
-          */
-          inform(""); // newline
-        }
+        // these properties of the subdevices of a device determine whether they're the same
+        snd_pcm_sync_id_t sync_id = snd_pcm_info_get_sync(pcminfo);
+        snprintf(d.properties, sizeof(d.properties), "%s/%s/%d/%d/%08x%08x%08x%08x",
+                 snd_pcm_info_get_id(pcminfo), snd_pcm_info_get_name(pcminfo),
+                 snd_pcm_info_get_class(pcminfo), snd_pcm_info_get_subclass(pcminfo),
+                 sync_id.id32[0], sync_id.id32[1], sync_id.id32[2], sync_id.id32[3]);
+        visitor(&d, context);
         sub_device++;
       } while ((check_subdevices != 0) && (sub_device < sub_device_count));
     }
@@ -605,6 +1175,16 @@ static int cards(void) {
       break;
     }
   }
+}
+
+static void report_device_visitor(const playback_device *d, __attribute__((unused)) void *context) {
+  report_device(d);
+}
+
+// Report on every playback device of every card.
+int cards(void) {
+  int response = 0;
+  enumerate_playback_devices(report_device_visitor, NULL);
 
   // now do a check on access to devices, even if they were found and listed.
 
@@ -703,8 +1283,397 @@ static int cards(void) {
   return response;
 }
 
+static const char *device_status_string(int status) {
+  if (status > 0)
+    return "usable";
+  switch (-status) {
+  case SPS_EXPLORE_STATUS_OK:
+    return "no suitable formats";
+  case SPS_EXPLORE_STATUS_CANT_SET_FORMAT:
+  case SPS_EXPLORE_STATUS_CANT_SET_SPEED:
+  case SPS_EXPLORE_STATUS_DEVICE_CANT_SET_HW_PARAMS:
+    return "unsuitable settings";
+  case SPS_EXPLORE_STATUS_DEVICE_BUSY:
+    return "busy";
+  case SPS_EXPLORE_STATUS_DEVICE_CANT_BE_OPENED:
+    return "can not be opened";
+  case SPS_EXPLORE_STATUS_524_ERROR:
+    return "HDMI port not initialised";
+  case SPS_EXPLORE_STATUS_NO_INFORMATION:
+    return "no information";
+  case SPS_EXPLORE_STATUS_CARD_WIDE_INFORMATION:
+    return "card-wide information only";
+  case SPS_EXPLORE_STATUS_DEVICE_CANT_SET_SW_PARAMS:
+    return "software parameters rejected";
+  default:
+    return "error";
+  }
+}
+
+static void snapshot_add_formats(const char *device_name, const unsigned int *speeds,
+                                 int number_of_speeds, const uint32_t *formats_found) {
+  int i;
+  size_t j;
+  for (i = 0; i < number_of_speeds; i++)
+    for (j = 0; j < sizeof(format_check_sequence) / sizeof(sps_format_t); j++)
+      if (formats_found[i] & (1 << format_check_sequence[j])) {
+        char rate_and_format[64];
+        snprintf(rate_and_format, sizeof(rate_and_format), "%u %s", speeds[i],
+                 sps_format_description_string(format_check_sequence[j]));
+        snapshot_add(device_name, "format", rate_and_format, "accepted");
+      }
+}
+
+// Write a snapshot of what the scan found about every device reported, to be compared with another
+// using --diff. Returns 0 on success.
+int write_snapshot(const char *path) {
+  struct utsname host;
+  if (uname(&host) == 0)
+    snapshot_add("-", "kernel", "-", "%s %s", host.sysname, host.release);
+#ifdef CONFIG_USE_GIT_VERSION_STRING
+  if (git_version_string[0] != '\0')
+    snapshot_add("-", "version", "-", "%s", git_version_string);
+  else
+#endif
+    snapshot_add("-", "version", "-", "%s", VERSION);
+  snapshot_add("-", "scan", "-", "%s", no_open != 0 ? "from /proc/asound" : "opening devices");
+  int i, j;
+  for (i = 0; i < device_record_count; i++) {
+    const device_record *r = &device_records[i];
+    const char *device_name = r->device.device_name;
+    snapshot_add(device_name, "card", "-", "%s (%s)", r->device.card_name, r->device.card_id);
+    snapshot_add(device_name, "device", "-", "%s (%s)", r->device.device_long_name,
+                 r->device.device_id);
+    snapshot_add(device_name, "subdevices", "-", "%d", r->device.sub_device_count);
+    snapshot_add(device_name, "status", "-", "%s", device_status_string(r->capabilities.status));
+    snapshot_add_formats(device_name, auto_speed_output_rates,
+                         sizeof(auto_speed_output_rates) / sizeof(int), r->capabilities.formats);
+    if (r->capabilities.alternates_checked != 0)
+      snapshot_add_formats(device_name, alternate_speed_output_rates,
+                           sizeof(alternate_speed_output_rates) / sizeof(int),
+                           r->capabilities.alternate_formats);
+    for (j = 0; j < r->mixer_count; j++) {
+      const mixer_analysis *m = &r->mixers[j];
+      char mixer_name[80];
+      snprintf(mixer_name, sizeof(mixer_name), "\"%s\",%u", m->name, m->index);
+      snapshot_add(device_name, "mixer", mixer_name,
+                   "%.2f dB to %.2f dB, %d steps, largest step %.2f dB, %s%s, score %d",
+                   m->min_db * 0.01, m->max_db * 0.01, m->steps, m->largest_step_db * 0.01,
+                   m->software != 0 ? "software" : "hardware",
+                   m->has_capture_elements != 0 ? ", shared with capture" : "", m->score);
+    }
+  }
+  return snapshot_write(path);
+}
+
+// Find the best format in which the device accepts a rate, or SPS_FORMAT_UNKNOWN if it doesn't.
+static sps_format_t best_format_at_rate(device_capabilities *capabilities, unsigned int rate) {
+  int rate_count = 0;
+  unsigned int rates[sizeof(auto_speed_output_rates) / sizeof(int) +
+                     sizeof(alternate_speed_output_rates) / sizeof(int)];
+  size_t i;
+  for (i = 0; i < sizeof(format_check_sequence) / sizeof(sps_format_t); i++) {
+    rate_count = rates_for_format(capabilities, format_check_sequence[i], rates);
+    int j;
+    for (j = 0; j < rate_count; j++)
+      if (rates[j] == rate)
+        return format_check_sequence[i];
+  }
+  return SPS_FORMAT_UNKNOWN;
+}
+
+// Play to all the usable devices found at once, at a rate they all accept, and report the drift
+// of their clocks. Returns 0 if it could be measured.
+int report_clock_drift(double seconds) {
+  const char **device_names = malloc((device_record_count + 1) * sizeof(char *));
+  snd_pcm_format_t *formats = malloc((device_record_count + 1) * sizeof(snd_pcm_format_t));
+  if ((device_names == NULL) || (formats == NULL))
+    die("can not allocate memory to measure clock drift.");
+  int usable_count = 0, i, pass;
+  for (i = 0; i < device_record_count; i++)
+    if (device_records[i].capabilities.status > 0)
+      usable_count++;
+  int device_count = 0;
+  unsigned int rate = 0;
+  // try the rates Shairport Sync uses first, then the others
+  for (pass = 0; (pass <= 1) && (device_count < usable_count); pass++) {
+    unsigned int *speeds = pass == 0 ? auto_speed_output_rates : alternate_speed_output_rates;
+    size_t speed_count = pass == 0 ? sizeof(auto_speed_output_rates) / sizeof(int)
+                                   : sizeof(alternate_speed_output_rates) / sizeof(int);
+    size_t k;
+    for (k = 0; (k < speed_count) && (device_count < usable_count); k++) {
+      int count = 0;
+      for (i = 0; i < device_record_count; i++) {
+        device_record *r = &device_records[i];
+        if (r->capabilities.status <= 0)
+          continue;
+        if (pass != 0)
+          check_alternate_speeds(r->device.device_name, &r->capabilities);
+        sps_format_t format = best_format_at_rate(&r->capabilities, speeds[k]);
+        if (format != SPS_FORMAT_UNKNOWN) {
+          device_names[count] = r->device.device_name;
+          formats[count++] = fr[format].alsa_code;
+        }
+      }
+      if (count > device_count) {
+        device_count = count;
+        rate = speeds[k];
+      }
+    }
+  }
+  int response = 0;
+  if (device_count < 2) {
+    inform("Clock drift can not be measured -- fewer than two usable devices accept a common "
+           "rate.");
+    response = 1;
+  } else {
+    // the list was overwritten while looking for a better rate, so make it again
+    device_count = 0;
+    for (i = 0; i < device_record_count; i++) {
+      device_record *r = &device_records[i];
+      sps_format_t format;
+      if ((r->capabilities.status > 0) &&
+          ((format = best_format_at_rate(&r->capabilities, rate)) != SPS_FORMAT_UNKNOWN)) {
+        device_names[device_count] = r->device.device_name;
+        formats[device_count++] = fr[format].alsa_code;
+      }
+    }
+    if (device_count < usable_count)
+      inform("Usable devices that don't accept %u frames per second are left out.", rate);
+    measure_drift(device_names, formats, device_count, rate, seconds);
+  }
+  free(formats);
+  free(device_names);
+  return response;
+}
+
+static int looks_like_hdmi(const char *name) {
+  char lower_case_name[128];
+  size_t i;
+  for (i = 0; (i < sizeof(lower_case_name) - 1) && (name[i] != '\0'); i++)
+    lower_case_name[i] = tolower((unsigned char)name[i]);
+  lower_case_name[i] = '\0';
+  return strstr(lower_case_name, "hdmi") != NULL;
+}
+
+// The points out of 100 for each quality that makes a device good for Shairport Sync.
+#define RECOMMEND_FORMAT_POINTS 30 // for the deepest format, less for shallower ones
+#define RECOMMEND_RATE_POINTS 15   // for accepting 44100, less if it would play at a higher rate
+#define RECOMMEND_MIXER_POINTS 40  // in proportion to the score of a playback-only mixer
+#define RECOMMEND_HW_POINTS 15     // for a hw device rather than HDMI
+// points taken off for shortcomings found by measurement
+#define RECOMMEND_UNDERRUN_PENALTY 20
+#define RECOMMEND_SLOW_PENALTY 5
+#define RECOMMEND_SLOW_STARTUP 0.2  // seconds to the first frame
+#define RECOMMEND_SLOW_RECOVERY 0.1 // seconds to the first frame after an underrun
+
+typedef struct {
+  const device_record *record;
+  unsigned int speed;
+  sps_format_t format;
+  const mixer_analysis *mixer; // the one to use, if any
+  int score;
+  char reasons[512];
+} recommendation;
+
+static void add_reason(recommendation *r, const char *format, ...) {
+  size_t length = strlen(r->reasons);
+  if ((length != 0) && (length < sizeof(r->reasons) - 2)) {
+    strcat(r->reasons, ", ");
+    length += 2;
+  }
+  va_list args;
+  va_start(args, format);
+  vsnprintf(r->reasons + length, sizeof(r->reasons) - length, format, args);
+  va_end(args);
+}
+
+static void score_device(recommendation *r) {
+  const device_record *d = r->record;
+  int width = snd_pcm_format_width(fr[r->format].alsa_code);
+  r->score = width > 8 ? RECOMMEND_FORMAT_POINTS * (width - 8) / 24 : 0;
+  add_reason(r, "%d-bit format (%s)", width, sps_format_description_string(r->format));
+  r->score += RECOMMEND_RATE_POINTS * 44100 / r->speed;
+  if (r->speed == 44100)
+    add_reason(r, "plays at 44100 without resampling");
+  else
+    add_reason(r, "would play at %u, as it doesn't accept 44100", r->speed);
+
+  int i;
+  for (i = 0; (i < d->mixer_count) && (r->mixer == NULL); i++)
+    if (d->mixers[i].has_capture_elements == 0)
+      r->mixer = &d->mixers[i];
+  if (r->mixer != NULL) {
+    r->score += RECOMMEND_MIXER_POINTS * r->mixer->score / 100;
+    add_reason(r, "playback-only mixer \"%s\" with a %.1f dB range (score %d)", r->mixer->name,
+               (r->mixer->max_db - r->mixer->min_db) * 0.01, r->mixer->score);
+  } else if (d->mixer_count > 0) {
+    r->mixer = &d->mixers[0];
+    r->score += RECOMMEND_MIXER_POINTS * r->mixer->score / 200;
+    add_reason(r, "mixer \"%s\" is shared with capture", r->mixer->name);
+  } else if (d->mixer_count == 0) {
+    add_reason(r, "no decibel-mapped mixer");
+  } else {
+    add_reason(r, "mixers not examined");
+  }
+
+  if (strncmp(d->device.device_name, "hdmi:", strlen("hdmi:")) == 0) {
+    add_reason(r, "HDMI, so it depends on the display");
+  } else {
+    r->score += RECOMMEND_HW_POINTS;
+    add_reason(r, "a direct hw device");
+  }
+
+  if (d->measured.underruns > 0) {
+    r->score -= RECOMMEND_UNDERRUN_PENALTY;
+    add_reason(r, "underran under load");
+  } else if (d->measured.underruns == 0) {
+    add_reason(r, "no underruns under load");
+  }
+  if (d->measured.startup_time > RECOMMEND_SLOW_STARTUP) {
+    r->score -= RECOMMEND_SLOW_PENALTY;
+    add_reason(r, "slow to start (%.0f ms)", d->measured.startup_time * 1000);
+  }
+  if (d->measured.recovery_time > RECOMMEND_SLOW_RECOVERY) {
+    r->score -= RECOMMEND_SLOW_PENALTY;
+    add_reason(r, "slow to recover from an underrun (%.0f ms)", d->measured.recovery_time * 1000);
+  }
+}
+
+static int compare_recommendations(const void *a, const void *b) {
+  const recommendation *ra = a, *rb = b;
+  if (ra->score != rb->score)
+    return rb->score - ra->score;
+  return ra->record - rb->record; // keep the order they were found in
+}
+
+// Rank the usable devices found, best first, with the reasons for their scores, and print the
+// Shairport Sync configuration for the best. Returns 0 if a device could be recommended.
+int recommend_devices(void) {
+  recommendation *recommendations = calloc(device_record_count + 1, sizeof(recommendation));
+  if (recommendations == NULL)
+    die("can not allocate memory to recommend a device.");
+  int count = 0, i;
+  for (i = 0; i < device_record_count; i++) {
+    recommendation *r = &recommendations[count];
+    if ((device_records[i].capabilities.status <= 0) ||
+        (first_speed_and_format(device_records[i].capabilities.formats, &r->speed, &r->format) !=
+         0))
+      continue;
+    r->record = &device_records[i];
+    score_device(&recommendations[count++]);
+  }
+  if (count == 0) {
+    inform("No device can be recommended, as none seems suitable for use with Shairport Sync.");
+    free(recommendations);
+    return 1;
+  }
+  qsort(recommendations, count, sizeof(recommendation), compare_recommendations);
+  inform("Recommended Devices, best first:");
+  for (i = 0; i < count; i++) {
+    inform("  %d. \"%s\"%*sScore: %3d", i + 1, recommendations[i].record->device.device_name,
+           (int)(40 - strlen(recommendations[i].record->device.device_name)), " ",
+           recommendations[i].score);
+    inform("     %s.", recommendations[i].reasons);
+  }
+  const recommendation *best = &recommendations[0];
+  const playback_device *d = &best->record->device;
+  inform("");
+  inform("Shairport Sync configuration for \"%s\":", d->device_name);
+  inform("alsa =");
+  inform("{");
+  inform("  output_device = \"%s\";", d->device_name);
+  if (best->mixer != NULL) {
+    // the mixer is on the card, which the output device names only if it is just "hw:<card_id>"
+    char mixer_device[80];
+    snprintf(mixer_device, sizeof(mixer_device), "hw:%s", d->card_id);
+    if (strcmp(d->device_name, mixer_device) != 0)
+      inform("  mixer_device = \"%s\";", mixer_device);
+    inform("  mixer_control_name = \"%s\";", best->mixer->name);
+    if (best->mixer->index != 0)
+      inform("  mixer_control_index = %u;", best->mixer->index);
+  }
+  inform("  output_rate = %u;", best->speed);
+  inform("  output_format = \"%s\";", sps_format_description_string(best->format));
+  inform("};");
+  inform("");
+  free(recommendations);
+  return 0;
+}
+
+// Like cards(), but using only what's in /proc/asound, so that no device is ever opened.
+int cards_from_proc(void) {
+  int response = 0;
+  int card_number = proc_asound_next_card(-1);
+  if (card_number < 0) {
+    inform("No sound cards were found in /proc/asound.");
+    response = -SPS_EXPLORE_STATUS_ERROR;
+  }
+  while (card_number >= 0) {
+    char card_id[64];
+    char card_name[80];
+    if (proc_asound_card_info_read(card_number, card_id, sizeof(card_id), card_name,
+                                   sizeof(card_name)) != 0) {
+      debug(1, "can not read the information for card %d from /proc/asound.", card_number);
+    } else {
+      // as with the hints used by cards(), one HDMI device makes it an HDMI card
+      char device_type[64];
+      strcpy(device_type, looks_like_hdmi(card_id) ? "hdmi" : "hw");
+      proc_asound_pcm_info pcm_info;
+      int dev = -1;
+      while ((dev = proc_asound_next_pcm_device(card_number, dev, SND_PCM_STREAM_PLAYBACK)) >= 0) {
+        if ((proc_asound_pcm_info_read(card_number, dev, 0, SND_PCM_STREAM_PLAYBACK, &pcm_info) ==
+             0) &&
+            (looks_like_hdmi(pcm_info.id) || looks_like_hdmi(pcm_info.name)))
+          strcpy(device_type, "hdmi");
+      }
+      sprintf(card, "hw:%d", card_number);
+      dev = -1;
+      while ((dev = proc_asound_next_pcm_device(card_number, dev, SND_PCM_STREAM_PLAYBACK)) >= 0) {
+        debug(2, "card number %d, device number: %d.", card_number, dev);
+        int sub_device_count =
+            proc_asound_subdevice_count(card_number, dev, SND_PCM_STREAM_PLAYBACK);
+        int sub_device = 0;
+        do {
+          if (proc_asound_pcm_info_read(card_number, dev, sub_device, SND_PCM_STREAM_PLAYBACK,
+                                        &pcm_info) != 0) {
+            debug(1, "can not read the information for card %d, device %d, subdevice %d.",
+                  card_number, dev, sub_device);
+          } else {
+            playback_device d;
+            memset(&d, 0, sizeof(d));
+            d.card_number = card_number;
+            d.dev = dev;
+            d.sub_device = sub_device;
+            d.sub_device_count = sub_device_count;
+            make_device_names(d.device_name, d.short_name, device_type, card_id, card_number, dev,
+                              sub_device, sub_device_count);
+            snprintf(d.card_id, sizeof(d.card_id), "%s", card_id);
+            snprintf(d.card_name, sizeof(d.card_name), "%s", card_name);
+            snprintf(d.device_id, sizeof(d.device_id), "%s", pcm_info.id);
+            snprintf(d.device_long_name, sizeof(d.device_long_name), "%s", pcm_info.name);
+            snprintf(d.subdevice_name, sizeof(d.subdevice_name), "%s", pcm_info.subname);
+            report_device(&d);
+          }
+          sub_device++;
+        } while ((check_subdevices != 0) && (sub_device < sub_device_count));
+      }
+    }
+    card_number = proc_asound_next_card(card_number);
+  }
+  return response;
+}
+
+// Built without main() for the scan benchmark, which links against the program's other functions.
+#ifndef SPS_ALSA_EXPLORE_NO_MAIN
 int main(int argc, char *argv[]) {
   int debug_level = 0;
+  double monitor_interval = 0.0;
+  const char *metrics_destination = "sps-alsa-explore.prom";
+  double drift_time = 0.0;
+  int recommend = 0;
+  const char *diff_a = NULL;
+  const char *diff_b = NULL;
   int i;
   for (i = 1; i < argc; ++i) {
     if (argv[i][0] == '-') {
@@ -739,7 +1708,8 @@ int main(int argc, char *argv[]) {
             "   or by the root user. Otherwise no ALSA devices will be found.\n"
             "2. Make sure any HDMI devices you wish to check are plugged in, turned on\n"
             "   and enabled when the machine boots up. Reboot if necessary.\n"
-            "3. If a device is in use, it can't be checked by this tool. In that case, you should\n"
+            "3. If a device is in use, it can't be checked fully by this tool. Its current\n"
+            "   settings are read from /proc/asound instead. To check it fully, you should\n"
             "   take the device out of use and run this tool again.\n"
             "4. If a device can not be accessed, it may mean that it needs to be configured or\n"
             "   connected to an active external device.\n"
@@ -749,7 +1719,68 @@ int main(int argc, char *argv[]) {
 
             "Command line arguments:\n"
             "    -e     extended information -- a little more information about each device,\n"
-            "    -s     check every subdevice,\n"
+            "    -s     check every subdevice -- subdevices identical to the first available one\n"
+            "           are just checked for availability,\n"
+            "    --no-open\n"
+            "           report using only the information in /proc/asound, without opening\n"
+            "           any device -- useful when a device is in use,\n"
+            "    --monitor INTERVAL\n"
+            "           instead of scanning, sample every playback substream from /proc/asound\n"
+            "           every INTERVAL seconds without opening it, until interrupted, and publish\n"
+            "           counters and gauges in Prometheus text format,\n"
+            "    --metrics FILE|unix:PATH\n"
+            "           where --monitor publishes the metrics -- a file, replaced at each sample,\n"
+            "           or a Unix socket to be read, e.g. with \"socat - UNIX-CONNECT:PATH\".\n"
+            "           The default is \"sps-alsa-explore.prom\",\n"
+            "    --timestamps\n"
+            "           measure each usable device's timestamps -- the kinds supported, their\n"
+            "           resolution and jitter -- by playing silence to it briefly,\n"
+            "    --position\n"
+            "           sample each usable device's position with snd_pcm_delay and\n"
+            "           snd_pcm_status every quarter millisecond while playing silence, and\n"
+            "           report how often it's updated, whether it ever goes backwards, how far it\n"
+            "           is from the position expected at the nominal rate, and so whether\n"
+            "           Shairport Sync needs to interpolate between updates,\n"
+            "    --startup RUNS[,IDLE_SECONDS]\n"
+            "           measure the time each usable device takes to play its first frame, cold\n"
+            "           (opened straight after closing, and opened after idling for\n"
+            "           IDLE_SECONDS seconds, 5 by default) and warm (stopped and prepared\n"
+            "           again), giving percentiles over RUNS runs of each. As the device idles\n"
+            "           before every run, this takes at least RUNS times IDLE_SECONDS seconds\n"
+            "           per device; an IDLE_SECONDS of 0 skips the runs after idling,\n"
+            "    --rate-switch RUNS\n"
+            "           measure how long each usable device takes to switch between each pair of\n"
+            "           rates it accepts, by reconfiguring it and by closing and reopening it,\n"
+            "           switching RUNS times each way,\n"
+            "    --period-profile SIZES\n"
+            "           for each of a comma-separated list of period sizes in frames, e.g.\n"
+            "           \"256,512,1024,2048\", play to each usable device with a poll()-driven\n"
+            "           writer and report the wakeups per second, CPU time, context switches and\n"
+            "           time asleep between periods that it costs,\n"
+            "    --stress THREADS[,MEGABYTES]\n"
+            "           play to each usable device for ten seconds while THREADS threads (0 for\n"
+            "           one on each of the other cores) keep the CPU busy, sweeping MEGABYTES of\n"
+            "           memory between them, once at normal priority and once with SCHED_FIFO\n"
+            "           and locked memory, and report underruns and the worst gap between writes,\n"
+            "    --xrun-recovery RUNS\n"
+            "           cause RUNS underruns on each usable device by stopping writes, and time\n"
+            "           the recovery and the wait for the first frame played afterwards, both\n"
+            "           stopping at an underrun and, if possible, free-running,\n"
+            "    --drift SECONDS\n"
+            "           after scanning, play to all the usable devices at once, at a rate they\n"
+            "           all accept, for SECONDS seconds, and report how far their clocks drift\n"
+            "           apart, in ppm, and which devices seem to share a clock,\n"
+            "    --recommend\n"
+            "           after scanning, rank the usable devices by their formats, rates, mixers\n"
+            "           and kind, and anything measured, giving the reasons, and print the\n"
+            "           Shairport Sync \"alsa\" settings for the best,\n"
+            "    --snapshot FILE\n"
+            "           write a record of every device found -- its status, the rates and formats\n"
+            "           it accepts and its mixers -- to FILE, to be compared later with --diff,\n"
+            "    --diff A B\n"
+            "           instead of scanning, print what changed between snapshots A and B --\n"
+            "           devices added or removed, rates and formats gained or lost, mixers\n"
+            "           changed. The exit status is 0 if nothing changed and 1 otherwise,\n"
             "    -V     print version,\n"
             "    -v     verbose log,\n"
             "    -vv    more verbose log,\n"
@@ -760,6 +1791,88 @@ int main(int argc, char *argv[]) {
         extended_output = 1;
       } else if (strcmp(argv[i] + 1, "s") == 0) {
         check_subdevices = 1;
+      } else if (strcmp(argv[i], "--no-open") == 0) {
+        no_open = 1;
+      } else if (strcmp(argv[i], "--timestamps") == 0) {
+        measurements.timestamps = 1;
+      } else if (strcmp(argv[i], "--position") == 0) {
+        measurements.position = 1;
+      } else if ((strcmp(argv[i], "--startup") == 0) && (i + 1 < argc)) {
+        char *end;
+        measurements.startup_runs = strtol(argv[++i], &end, 10);
+        measurements.startup_idle_time = MEASURE_DEFAULT_IDLE_TIME;
+        if (*end == ',')
+          measurements.startup_idle_time = strtol(end + 1, &end, 10);
+        if ((*end != '\0') || (measurements.startup_runs <= 0) ||
+            (measurements.startup_idle_time < 0)) {
+          fprintf(stdout, "%s -- invalid number of runs or idle time. Program terminated.\n",
+                  argv[i]);
+          exit(EXIT_FAILURE);
+        }
+      } else if ((strcmp(argv[i], "--rate-switch") == 0) && (i + 1 < argc)) {
+        measurements.rate_switch_runs = atoi(argv[++i]);
+        if (measurements.rate_switch_runs <= 0) {
+          fprintf(stdout, "%s -- invalid number of runs. Program terminated.\n", argv[i]);
+          exit(EXIT_FAILURE);
+        }
+      } else if ((strcmp(argv[i], "--period-profile") == 0) && (i + 1 < argc)) {
+        char *list = argv[++i];
+        while ((*list != '\0') && (measurements.period_size_count < MEASURE_MAX_PERIOD_SIZES)) {
+          char *end;
+          unsigned long period_size = strtoul(list, &end, 10);
+          if ((end == list) || (period_size == 0) || ((*end != ',') && (*end != '\0'))) {
+            fprintf(stdout, "%s -- invalid list of period sizes. Program terminated.\n", argv[i]);
+            exit(EXIT_FAILURE);
+          }
+          // keep them in ascending order
+          int j = measurements.period_size_count++;
+          for (; (j > 0) && (measurements.period_sizes[j - 1] > period_size); j--)
+            measurements.period_sizes[j] = measurements.period_sizes[j - 1];
+          measurements.period_sizes[j] = period_size;
+          list = *end == ',' ? end + 1 : end;
+        }
+      } else if (strcmp(argv[i], "--recommend") == 0) {
+        recommend = 1;
+      } else if ((strcmp(argv[i], "--xrun-recovery") == 0) && (i + 1 < argc)) {
+        measurements.xrun_runs = atoi(argv[++i]);
+        if (measurements.xrun_runs <= 0) {
+          fprintf(stdout, "%s -- invalid number of runs. Program terminated.\n", argv[i]);
+          exit(EXIT_FAILURE);
+        }
+      } else if ((strcmp(argv[i], "--stress") == 0) && (i + 1 < argc)) {
+        char *end;
+        measurements.stress = 1;
+        measurements.stress_threads = strtol(argv[++i], &end, 10);
+        if (*end == ',')
+          measurements.stress_megabytes = strtol(end + 1, &end, 10);
+        if ((*end != '\0') || (measurements.stress_threads < 0) ||
+            (measurements.stress_megabytes < 0)) {
+          fprintf(stdout, "%s -- invalid load. Program terminated.\n", argv[i]);
+          exit(EXIT_FAILURE);
+        }
+      } else if ((strcmp(argv[i], "--drift") == 0) && (i + 1 < argc)) {
+        char *end;
+        drift_time = strtod(argv[++i], &end);
+        if ((*end != '\0') || (drift_time < 5.0)) {
+          fprintf(stdout, "%s -- invalid time, which must be at least 5 seconds. Program "
+                          "terminated.\n",
+                  argv[i]);
+          exit(EXIT_FAILURE);
+        }
+      } else if ((strcmp(argv[i], "--monitor") == 0) && (i + 1 < argc)) {
+        char *end;
+        monitor_interval = strtod(argv[++i], &end);
+        if ((*end != '\0') || (monitor_interval < 0.01)) {
+          fprintf(stdout, "%s -- invalid monitoring interval. Program terminated.\n", argv[i]);
+          exit(EXIT_FAILURE);
+        }
+      } else if ((strcmp(argv[i], "--metrics") == 0) && (i + 1 < argc)) {
+        metrics_destination = argv[++i];
+      } else if ((strcmp(argv[i], "--snapshot") == 0) && (i + 1 < argc)) {
+        snapshot_path = argv[++i];
+      } else if ((strcmp(argv[i], "--diff") == 0) && (i + 2 < argc)) {
+        diff_a = argv[++i];
+        diff_b = argv[++i];
       } else {
         fprintf(stdout, "%s -- unknown option. Program terminated.\n", argv[0]);
         exit(EXIT_FAILURE);
@@ -767,5 +1880,21 @@ int main(int argc, char *argv[]) {
     }
   }
   debug_init(debug_level, 0, 1, 1);
-  return cards() ? 1 : 0;
+  if (diff_a != NULL) {
+    int differences = snapshot_diff(diff_a, diff_b);
+    return differences < 0 ? 2 : differences;
+  }
+  if (monitor_interval > 0.0)
+    return monitor_playback_devices(monitor_interval, metrics_destination) ? 1 : 0;
+  int response = no_open != 0 ? cards_from_proc() : cards();
+  debug(1, "PCM device opens: %d, opens avoided by pre-screening: %d, mixer opens: %d.",
+        pcm_open_count, prescreen_skip_count, mixer_open_count);
+  if ((drift_time > 0.0) && (no_open == 0) && (report_clock_drift(drift_time) != 0))
+    response = 1;
+  if ((recommend != 0) && (recommend_devices() != 0))
+    response = 1;
+  if ((snapshot_path != NULL) && (write_snapshot(snapshot_path) != 0))
+    response = 1;
+  return response ? 1 : 0;
 }
+#endif
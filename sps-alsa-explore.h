@@ -21,3 +21,108 @@
  */
 
 // extended and modified (C) 2021-2022 by Mike Brady <4265913+mikebrady@users.noreply.github.com>
+
+#ifndef _SPS_ALSA_EXPLORE_H
+#define _SPS_ALSA_EXPLORE_H
+
+#include "procfs.h"
+#include <alsa/asoundlib.h>
+#include <stdint.h>
+
+// the negative of these enums is used as an error code
+typedef enum {
+  SPS_EXPLORE_STATUS_OK = 0,
+  SPS_EXPLORE_STATUS_ERROR,
+  SPS_EXPLORE_STATUS_CANT_SET_FORMAT,
+  SPS_EXPLORE_STATUS_CANT_SET_SPEED,
+  SPS_EXPLORE_STATUS_DEVICE_BUSY,
+  SPS_EXPLORE_STATUS_DEVICE_CANT_BE_OPENED,
+  SPS_EXPLORE_STATUS_DEVICE_CANT_SET_HW_PARAMS,
+  SPS_EXPLORE_STATUS_524_ERROR, // seems to be when the HDMI device can't be initialised
+  SPS_EXPLORE_STATUS_NO_INFORMATION, // nothing can be predicted without opening the device
+  SPS_EXPLORE_STATUS_CARD_WIDE_INFORMATION, // only what the card as a whole accepts is known
+  SPS_EXPLORE_STATUS_DEVICE_CANT_SET_SW_PARAMS,
+} sps_explore_status;
+
+// the time taken by the stages of open_alsa_device_with_settings(), in seconds
+typedef struct {
+  double open;
+  double configure; // setting the hardware and software parameters
+} alsa_device_timing;
+
+// Optional settings for open_alsa_device_with_settings(). Zero leaves a setting at its default.
+typedef struct {
+  snd_pcm_uframes_t period_size;
+  snd_pcm_uframes_t buffer_size;
+  int set_tstamp_type; // if set, use tstamp_type
+  snd_pcm_tstamp_type_t tstamp_type;
+  int explicit_start; // if set, playback doesn't start until snd_pcm_start() is called
+  int free_running;   // if set, the stop threshold is the boundary, so underruns don't stop it
+  alsa_device_timing *timing; // if not NULL, the time taken by each stage is recorded here
+  int *alsa_error; // if not NULL, the ALSA error code of a failure is recorded here
+} alsa_device_settings;
+
+// A playback device, or a subdevice if every subdevice is being checked.
+typedef struct {
+  char device_name[128]; // the "Device Full Name", e.g. "hw:CARD=PCH,DEV=3"
+  char short_name[128];  // e.g. "hw:0,3"
+  int card_number;
+  int dev;
+  int sub_device;
+  int sub_device_count;
+  char card_id[64];
+  char card_name[80];
+  char device_id[64];
+  char device_long_name[80];
+  char subdevice_name[80];
+  char properties[256]; // subdevices with the same properties have the same constraints
+} playback_device;
+
+typedef void (*playback_device_visitor)(const playback_device *d, void *context);
+
+extern char card[64]; // the card being examined, e.g. "hw:0"
+extern int extended_output;
+extern int check_subdevices;
+
+// the rates checked by check_alsa_device(), normally and with check_alternate_speeds set
+extern unsigned int auto_speed_output_rates[4];
+extern unsigned int alternate_speed_output_rates[5];
+
+// if set, combinations of rate and format it doesn't allow are skipped without opening the device
+extern proc_asound_prediction *prescreen;
+
+// what scanning has cost so far, as counted for the scan benchmark (tests/scan-benchmark.c)
+extern int pcm_open_count;
+extern int prescreen_skip_count; // combinations of rate and format ruled out by the prescreen
+extern int mixer_open_count;
+
+// Call the visitor for each playback device on each card, or for each subdevice if
+// check_subdevices is set. This opens the cards' control devices but not their PCM devices.
+void enumerate_playback_devices(playback_device_visitor visitor, void *context);
+
+// Open the device for two-channel interleaved playback in the format and at the rate given,
+// with timestamps enabled and any settings given (settings can be NULL).
+// Returns 0 with the handle open and ready to be prepared, or the negative of an
+// sps_explore_status.
+int open_alsa_device_with_settings(const char *device, snd_pcm_format_t sample_format,
+                                   unsigned int sample_rate, const alsa_device_settings *settings,
+                                   snd_pcm_t **handle);
+
+// Set the hardware and software parameters of an open device, as above, e.g. after
+// snd_pcm_hw_free(). Returns 0 or the negative of an sps_explore_status.
+int configure_alsa_device_with_settings(snd_pcm_t *alsa_handle, const char *device,
+                                        snd_pcm_format_t sample_format, unsigned int sample_rate,
+                                        const alsa_device_settings *settings);
+
+// Check every combination of the rates and formats Shairport Sync might use (or the alternate
+// rates). If formats_found is not NULL, for each rate, a bit (1 << sps_format_t) is set in the
+// corresponding element for every format accepted. Returns 0 or the negative of an
+// sps_explore_status.
+int check_alsa_device(const char *device, int check_alternate_speeds, uint32_t *formats_found);
+
+// Load and analyse the decibel-mapped playback mixers of card, unless they were analysed for the
+// last device. Returns the number of mixers, or a negative error code.
+int load_mixers(void);
+void forget_mixers(void); // so that load_mixers() analyses them again
+
+#endif /* _SPS_ALSA_EXPLORE_H */
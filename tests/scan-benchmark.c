@@ -0,0 +1,232 @@
+/*
+ * This file is part of the sps-alsa-explore distribution
+ * (https://github.com/mikebrady/sps-alsa-explore). Copyright (c) 2021-2024 Mike Brady.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Commercial licensing is also available.
+ */
+
+
+// A benchmark of the scanner's probe paths, run by "make check".
+// Each scenario is run against the devices defined in asound.conf, which is used in place of the
+// system's ALSA configuration, so that the results don't depend on the sound hardware present.
+// The number of PCM opens, prescreen skips and mixer opens of each scenario -- which depend only
+// on the code -- are written to the results file and compared with the baseline file:
+// a scenario fails if it opens more devices or skips fewer combinations than the baseline says.
+// The best wall time of a few runs is written too, so that runs can be compared, but it isn't
+// checked, as it depends on the machine and how busy it is.
+// If SCAN_BENCHMARK_UPDATE is set, the baseline is rewritten from the results instead.
+//
+// Enumerating the system's cards isn't benchmarked: asound.conf replaces the system's
+// configuration, including its definitions of the hw devices, so cards can't be opened,
+// and with no sound hardware there would be nothing to enumerate anyway.
+
+#include "../sps-alsa-explore.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SCAN_BENCHMARK_RUNS 5
+
+typedef struct {
+  const char *name;
+  void (*run)(void);
+} scan_benchmark_scenario;
+
+typedef struct {
+  char name[64];
+  int pcm_opens;
+  int prescreen_skips;
+  int mixer_opens;
+  double milliseconds; // informational only
+} scan_benchmark_result;
+
+static void probe_null(void) {
+  uint32_t formats_found[sizeof(auto_speed_output_rates) / sizeof(int)];
+  check_alsa_device("bench_null", 0, formats_found);
+}
+
+static void probe_null_alternate_speeds(void) {
+  uint32_t formats_found[sizeof(alternate_speed_output_rates) / sizeof(int)];
+  check_alsa_device("bench_null", 1, formats_found);
+}
+
+// as if /proc/asound said the device accepts only S16_LE at 44100
+static void probe_null_prescreened(void) {
+  proc_asound_prediction prediction;
+  memset(&prediction, 0, sizeof(prediction));
+  snprintf(prediction.source, sizeof(prediction.source), "scan benchmark");
+  prediction.count = 1;
+  prediction.entries[0].formats = (uint64_t)1 << SND_PCM_FORMAT_S16_LE;
+  prediction.entries[0].channels_min = 2;
+  prediction.entries[0].channels_max = 2;
+  prediction.entries[0].rates[0] = 44100;
+  prediction.entries[0].rate_count = 1;
+  uint32_t formats_found[sizeof(auto_speed_output_rates) / sizeof(int)];
+  prescreen = &prediction;
+  check_alsa_device("bench_null", 0, formats_found);
+  prescreen = NULL;
+}
+
+static void probe_file(void) {
+  uint32_t formats_found[sizeof(auto_speed_output_rates) / sizeof(int)];
+  check_alsa_device("bench_file", 0, formats_found);
+}
+
+static void probe_missing(void) {
+  uint32_t formats_found[sizeof(auto_speed_output_rates) / sizeof(int)];
+  check_alsa_device("bench_missing", 0, formats_found);
+}
+
+static void mixers_missing(void) {
+  snprintf(card, sizeof(card), "bench_missing");
+  forget_mixers(); // so that they're loaded every time
+  load_mixers();
+}
+
+static scan_benchmark_scenario scenarios[] = {
+    {"probe-null", probe_null},
+    {"probe-null-alternate-speeds", probe_null_alternate_speeds},
+    {"probe-null-prescreened", probe_null_prescreened},
+    {"probe-file", probe_file},
+    {"probe-missing", probe_missing},
+    {"mixers-missing", mixers_missing},
+};
+
+#define SCAN_BENCHMARK_SCENARIO_COUNT ((int)(sizeof(scenarios) / sizeof(scenarios[0])))
+
+static double time_now_ms(void) {
+  struct timespec tn;
+  clock_gettime(CLOCK_MONOTONIC, &tn);
+  return tn.tv_sec * 1000.0 + tn.tv_nsec * 0.000001;
+}
+
+static int write_results(const char *path, const scan_benchmark_result *results, int count) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "can not write \"%s\": %s.\n", path, strerror(errno));
+    return -1;
+  }
+  fprintf(f, "# sps-alsa-explore scan benchmark, version 3\n"
+             "# scenario pcm_opens prescreen_skips mixer_opens milliseconds (not checked)\n");
+  int i;
+  for (i = 0; i < count; i++)
+    fprintf(f, "%s %d %d %d %.3f\n", results[i].name, results[i].pcm_opens,
+            results[i].prescreen_skips, results[i].mixer_opens, results[i].milliseconds);
+  return fclose(f);
+}
+
+// returns the number of results read, or -1 if the file can't be read
+static int read_results(const char *path, scan_benchmark_result *results, int size) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return -1;
+  char line[256];
+  int count = 0;
+  while ((count < size) && (fgets(line, sizeof(line), f) != NULL)) {
+    if (line[0] == '#')
+      continue;
+    results[count].milliseconds = 0.0; // for information only, so it may be missing
+    if (sscanf(line, "%63s %d %d %d %lf", results[count].name, &results[count].pcm_opens,
+               &results[count].prescreen_skips, &results[count].mixer_opens,
+               &results[count].milliseconds) >= 4)
+      count++;
+  }
+  fclose(f);
+  return count;
+}
+
+int main(void) {
+  const char *results_path = getenv("SCAN_BENCHMARK_RESULTS");
+  const char *baseline_path = getenv("SCAN_BENCHMARK_BASELINE");
+  if (results_path == NULL)
+    results_path = "scan-benchmark.results";
+  if (baseline_path == NULL)
+    baseline_path = "scan-benchmark.baseline";
+  if (getenv("ALSA_CONFIG_PATH") == NULL) {
+    fprintf(stderr, "ALSA_CONFIG_PATH must be set to the benchmark's asound.conf.\n");
+    return 99; // a hard error, as far as the test harness is concerned
+  }
+  debug_init(0, 0, 1, 1);
+
+  scan_benchmark_result results[SCAN_BENCHMARK_SCENARIO_COUNT];
+  int i, run;
+  for (i = 0; i < SCAN_BENCHMARK_SCENARIO_COUNT; i++) {
+    snprintf(results[i].name, sizeof(results[i].name), "%s", scenarios[i].name);
+    results[i].milliseconds = 0.0;
+    for (run = 0; run < SCAN_BENCHMARK_RUNS; run++) {
+      pcm_open_count = 0;
+      prescreen_skip_count = 0;
+      mixer_open_count = 0;
+      double start_time = time_now_ms();
+      scenarios[i].run();
+      double elapsed_time = time_now_ms() - start_time;
+      if ((run == 0) || (elapsed_time < results[i].milliseconds))
+        results[i].milliseconds = elapsed_time;
+    }
+    results[i].pcm_opens = pcm_open_count;
+    results[i].prescreen_skips = prescreen_skip_count;
+    results[i].mixer_opens = mixer_open_count;
+    printf("%-30s %4d PCM opens, %4d prescreen skips, %4d mixer opens, %9.3f ms.\n",
+           results[i].name, results[i].pcm_opens, results[i].prescreen_skips,
+           results[i].mixer_opens, results[i].milliseconds);
+  }
+  printf("enumerate-cards: skipped, as the system's cards can't be opened with the benchmark's "
+         "ALSA configuration.\n");
+  if (write_results(results_path, results, SCAN_BENCHMARK_SCENARIO_COUNT) != 0)
+    return 99;
+
+  if (getenv("SCAN_BENCHMARK_UPDATE") != NULL) {
+    printf("Baseline \"%s\" updated.\n", baseline_path);
+    return write_results(baseline_path, results, SCAN_BENCHMARK_SCENARIO_COUNT) != 0 ? 99 : 0;
+  }
+
+  scan_benchmark_result baseline[SCAN_BENCHMARK_SCENARIO_COUNT];
+  int baseline_count = read_results(baseline_path, baseline, SCAN_BENCHMARK_SCENARIO_COUNT);
+  if (baseline_count < 0) {
+    fprintf(stderr, "can not read the baseline \"%s\": %s.\n", baseline_path, strerror(errno));
+    return 99;
+  }
+  int regressions = 0;
+  for (i = 0; i < SCAN_BENCHMARK_SCENARIO_COUNT; i++) {
+    int j;
+    for (j = 0; (j < baseline_count) && (strcmp(baseline[j].name, results[i].name) != 0); j++)
+      ;
+    if (j == baseline_count) {
+      printf("%s: not in the baseline.\n", results[i].name);
+      continue;
+    }
+    if (results[i].pcm_opens > baseline[j].pcm_opens) {
+      printf("%s: REGRESSION: %d PCM opens, %d in the baseline.\n", results[i].name,
+             results[i].pcm_opens, baseline[j].pcm_opens);
+      regressions++;
+    }
+    if (results[i].prescreen_skips < baseline[j].prescreen_skips) {
+      printf("%s: REGRESSION: %d prescreen skips, %d in the baseline.\n", results[i].name,
+             results[i].prescreen_skips, baseline[j].prescreen_skips);
+      regressions++;
+    }
+    if (results[i].mixer_opens > baseline[j].mixer_opens) {
+      printf("%s: REGRESSION: %d mixer opens, %d in the baseline.\n", results[i].name,
+             results[i].mixer_opens, baseline[j].mixer_opens);
+      regressions++;
+    }
+    if ((results[i].pcm_opens < baseline[j].pcm_opens) ||
+        (results[i].mixer_opens < baseline[j].mixer_opens))
+      printf("%s: fewer opens than in the baseline -- consider updating it.\n", results[i].name);
+  }
+  return regressions != 0 ? 1 : 0;
+}